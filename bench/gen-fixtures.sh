@@ -0,0 +1,119 @@
+#!/bin/bash
+# Generates a synthetic pacman database for the benchmarks.
+#
+#   gen-fixtures.sh <dir> <installed> <sync>
+#
+# Writes <dir>/local (installed packages, including a few AUR ones),
+# <dir>/sync/{core,extra}.db, and the outdated/orphan lists the pacman stub
+# prints. Names and versions are derived from the package index, so the same
+# arguments always produce the same tree.
+
+set -euo pipefail
+
+if [ $# -ne 3 ]; then
+    echo "usage: $0 <dir> <installed> <sync>" >&2
+    exit 1
+fi
+
+dir=$1
+installed=$2
+sync=$3
+
+rm -rf "$dir"
+mkdir -p "$dir/local" "$dir/sync" "$dir/src/core" "$dir/src/extra"
+
+# The awk program runs twice: "dirs" prints every package directory so one
+# mkdir can create them all, "files" then writes the desc files.
+generate() {
+awk -v mode="$1" -v dir="$dir" -v installed="$installed" -v sync="$sync" '
+function pkgname(i,    a, b, c) {
+    a = i % ns
+    b = int(i / ns) % ns
+    c = int(i / (ns * ns))
+    if (i < ns) return syl[a + 1]
+    if (i < ns * ns) return syl[b + 1] "-" syl[a + 1]
+    return syl[c % ns + 1] "-" syl[b + 1] "-" syl[a + 1] (c >= ns ? c : "")
+}
+
+function package_dir(d) {
+    if (mode == "dirs") print d
+    return mode == "files"
+}
+
+function write_desc(path, name, ver, desc, date, reason, deps, provides,    n, list, k) {
+    printf "%%NAME%%\n%s\n\n%%VERSION%%\n%s\n\n%%DESC%%\n%s\n\n", name, ver, desc > path
+    printf "%%BUILDDATE%%\n%d\n\n%%INSTALLDATE%%\n%d\n\n", date, date + 3600 > path
+    if (reason != "") printf "%%REASON%%\n%s\n\n", reason > path
+    printf "%%ARCH%%\nx86_64\n\n%%LICENSE%%\nGPL\n\n" > path
+    if (deps != "") {
+        n = split(deps, list, " ")
+        printf "%%DEPENDS%%\n" > path
+        for (k = 1; k <= n; k++) printf "%s\n", list[k] > path
+        printf "\n" > path
+    }
+    if (provides != "") printf "%%PROVIDES%%\n%s\n\n", provides > path
+    close(path)
+}
+
+BEGIN {
+    ns = split("lib python perl qt5 gtk3 xorg ttf haskell rust go nodejs ruby kde gnome vim " \
+               "emacs firefox linux mesa vulkan ffmpeg gst plugin tools utils core data ssl " \
+               "audio video net git docs cli", syl, " ")
+    now = 1700000000
+
+    # Sync repos: the first 4% go to core, the rest to extra.
+    for (i = 0; i < sync; i++) {
+        name = pkgname(i)
+        repo = (i < sync / 25) ? "core" : "extra"
+        ver = (i % 9 + 1) "." (i % 17) "." (i % 5) "-" (i % 3 + 1)
+        d = dir "/src/" repo "/" name "-" ver
+        if (!package_dir(d)) continue
+        path = d "/desc"
+        printf "%%FILENAME%%\n%s-%s-x86_64.pkg.tar.zst\n\n", name, ver > path
+        printf "%%CSIZE%%\n%d\n\n%%ISIZE%%\n%d\n\n", 10000 + i * 37, 40000 + i * 91 > path
+        printf "%%SHA256SUM%%\n%064d\n\n", i > path
+        write_desc(path, name, ver, "Synthetic package " i " for benchmarks", now - (i * 7919 % 1000) * 86400, "",
+                   "glibc " pkgname((i * 31) % sync) " " pkgname((i * 17) % sync), name "-libs")
+    }
+
+    # Installed: every (sync / installed)-th sync package, 5% one release
+    # behind, plus 20 AUR packages.
+    step = sync / installed
+    for (k = 0; k < installed; k++) {
+        i = int(k * step)
+        name = pkgname(i)
+        rel = i % 3 + 1
+        ver = (i % 9 + 1) "." (i % 17) "." (i % 5) "-" rel
+        if (k % 20 == 0) {
+            newver = ver
+            ver = (i % 9 + 1) "." (i % 17) "." (i % 5) "-0"
+            if (mode == "files") print name " " ver " -> " newver > (dir "/outdated.txt")
+        }
+        reason = (k % 4 == 0) ? "0" : "1"
+        if (k % 50 == 7 && mode == "files") print name > (dir "/orphans.txt")
+        d = dir "/local/" name "-" ver
+        if (!package_dir(d)) continue
+        write_desc(d "/desc", name, ver, "Synthetic package " i, now - (i * 7919 % 1000) * 86400, reason,
+                   "glibc " pkgname((i * 31) % sync), "")
+    }
+    for (k = 0; k < 20; k++) {
+        name = sprintf("aur-bench-%02d", k)
+        d = dir "/local/" name "-1.0.0-1"
+        if (!package_dir(d)) continue
+        write_desc(d "/desc", name, "1.0.0-1", "Synthetic AUR package", now - k * 86400 * 30, "0", "glibc", "")
+    }
+    if (mode == "files") {
+        printf "" >> (dir "/outdated.txt")
+        printf "" >> (dir "/orphans.txt")
+    }
+}'
+}
+
+generate dirs | xargs mkdir -p
+generate files
+
+echo 9 > "$dir/local/ALPM_DB_VERSION"
+for repo in core extra; do
+    tar -czf "$dir/sync/$repo.db" -C "$dir/src/$repo" .
+done
+rm -rf "$dir/src"
@@ -0,0 +1,98 @@
+#!/bin/bash
+# Benchmarks rinse against the stub pacman/yay/flatpak/curl in bench/stubs.
+#
+#   bench/run.sh [small|medium|full ...]     (default: all three)
+#
+# Environment:
+#   RUNS                 timed runs per scenario (default 5, after one warm-up)
+#   RINSE_BENCH_LATENCY  seconds each stub call sleeps (default 0.005)
+#   CXX, CXXFLAGS        compiler and flags for the benchmark build
+#
+# Reports the median and fastest wall time of each scenario, and how many
+# subprocesses rinse started (counted from its --trace output).
+
+set -euo pipefail
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+out=$bench_dir/out
+runs=${RUNS:-5}
+scales=("$@")
+[ ${#scales[@]} -eq 0 ] && scales=(small medium full)
+
+export RINSE_BENCH_LATENCY=${RINSE_BENCH_LATENCY:-0.005}
+
+mkdir -p "$out"
+echo "Building rinse..."
+${CXX:-g++} -std=c++17 ${CXXFLAGS:--O3} "$bench_dir/../rinse.cpp" -o "$out/rinse" -pthread
+
+# Isolated home and cache, with notifications off and the AUR pointed at the curl stub.
+home=$out/home
+rm -rf "$home"
+mkdir -p "$home/.config/rinse" "$home/flatpak-system" "$home/flatpak-user"
+cat > "$home/.config/rinse/rinse.conf" <<CONF
+notify = false
+aur_url = http://aur.bench
+aur_cache_ttl = 0
+CONF
+
+export HOME=$home
+export XDG_CACHE_HOME=$home/.cache
+export FLATPAK_SYSTEM_DIR=$home/flatpak-system
+export FLATPAK_USER_DIR=$home/flatpak-user
+export PATH=$bench_dir/stubs:$PATH
+unset RINSE_TRACE
+
+scale_sizes() {
+    case $1 in
+        small) echo "300 1500" ;;
+        medium) echo "1000 5000" ;;
+        full) echo "3000 15000" ;;
+        *) echo "unknown scale: $1" >&2; exit 1 ;;
+    esac
+}
+
+now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# run_scenario <name> <rinse args...>
+run_scenario() {
+    local name=$1
+    shift
+    local trace=$out/trace.json
+    local times=()
+    local execs=0
+
+    "$out/rinse" -b "$db" "$@" < /dev/null > /dev/null 2>&1 || true
+    for ((r = 0; r < runs; r++)); do
+        local start end
+        start=$(now_ms)
+        "$out/rinse" --trace="$trace" -b "$db" "$@" < /dev/null > /dev/null 2>&1 || true
+        end=$(now_ms)
+        times+=($((end - start)))
+        execs=$(grep -c '"cat":"exec"' "$trace" || true)
+    done
+
+    local sorted
+    sorted=($(printf '%s\n' "${times[@]}" | sort -n))
+    printf '%-8s %-14s %8s %8s %6s\n' "$scale" "$name" "${sorted[$((runs / 2))]}" "${sorted[0]}" "$execs"
+}
+
+printf '%-8s %-14s %8s %8s %6s\n' scale scenario median_ms min_ms execs
+for scale in "${scales[@]}"; do
+    read -r installed sync <<< "$(scale_sizes "$scale")"
+    db=$out/$scale
+    if [ ! -f "$db/.stamp-$installed-$sync" ]; then
+        "$bench_dir/gen-fixtures.sh" "$db" "$installed" "$sync"
+        touch "$db/.stamp-$installed-$sync"
+    fi
+    export RINSE_BENCH_DATA=$db
+
+    repo_pkg=$(cut -d" " -f1 "$db/outdated.txt" | head -1)
+    run_scenario install -y install "$repo_pkg" aur-bench-new firefx
+    run_scenario remove -y remove "$repo_pkg"
+    run_scenario lookup lookup
+    run_scenario lookup-term lookup python
+    run_scenario outdated outdated --time 1y
+    run_scenario clean -y clean
+done
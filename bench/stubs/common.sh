@@ -0,0 +1,21 @@
+# Shared by the bench stubs: log the call and simulate the tool's latency.
+# RINSE_BENCH_LATENCY is in seconds (default 0.005).
+[ -n "${RINSE_BENCH_LOG:-}" ] && echo "$(basename "$0") $*" >> "$RINSE_BENCH_LOG"
+sleep "${RINSE_BENCH_LATENCY:-0.005}"
+
+# Prints pacman-style "(i/n) verb name" lines, one per package argument.
+progress_lines() {
+    verb=$1
+    shift
+    n=0
+    for arg in "$@"; do
+        case $arg in -*) ;; *) n=$((n + 1)) ;; esac
+    done
+    i=0
+    for arg in "$@"; do
+        case $arg in
+            -*) ;;
+            *) i=$((i + 1)); echo "($i/$n) $verb $arg" ;;
+        esac
+    done
+}
@@ -0,0 +1,103 @@
+#!/bin/bash
+# Checks `rinse vercmp` against the test vectors from pacman's vercmptest.sh.
+#
+#   bench/vercmp-vectors.sh
+#
+# Environment:
+#   CXX, CXXFLAGS        compiler and flags for the build
+#
+# Every pair is also checked reversed, with the expected result negated.
+# Exits non-zero if any comparison disagrees with pacman.
+
+set -euo pipefail
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+out=$bench_dir/out
+
+mkdir -p "$out"
+echo "Building rinse..."
+${CXX:-g++} -std=c++17 ${CXXFLAGS:--O3} "$bench_dir/../rinse.cpp" -o "$out/rinse" -pthread
+
+# a  b  expected
+vectors=(
+    # all similar length, no pkgrel
+    "1.5.0 1.5.0 0"
+    "1.5.1 1.5.0 1"
+    # mixed length
+    "1.5.1 1.5 1"
+    # with pkgrel, simple
+    "1.5.0-1 1.5.0-1 0"
+    "1.5.0-1 1.5.0-2 -1"
+    "1.5.0-1 1.5.1-1 -1"
+    "1.5.0-2 1.5.1-1 -1"
+    # with pkgrel, mixed lengths
+    "1.5-1 1.5.1-1 -1"
+    "1.5-2 1.5.1-1 -1"
+    "1.5-2 1.5.1-2 -1"
+    # mixed pkgrel inclusion
+    "1.5 1.5-1 0"
+    "1.5-1 1.5 0"
+    "1.1-1 1.1 0"
+    "1.0-1 1.1 -1"
+    "1.1-1 1.0 1"
+    # alphanumeric versions
+    "1.5b-1 1.5-1 -1"
+    "1.5b 1.5 -1"
+    "1.5b-1 1.5 -1"
+    "1.5b 1.5.1 -1"
+    # from the manpage
+    "1.0a 1.0alpha -1"
+    "1.0alpha 1.0b -1"
+    "1.0b 1.0beta -1"
+    "1.0beta 1.0rc -1"
+    "1.0rc 1.0 -1"
+    # alpha-dotted versions
+    "1.5.a 1.5 1"
+    "1.5.b 1.5.a 1"
+    "1.5.1 1.5.b 1"
+    # alpha dots and dashes
+    "1.5.b-1 1.5.b 0"
+    "1.5-1 1.5.b -1"
+    # same/similar content, differing separators
+    "2.0 2_0 0"
+    "2.0_a 2_0.a 0"
+    "2.0a 2.0.a -1"
+    "2___a 2_a 1"
+    # epoch included version comparisons
+    "0:1.0 0:1.0 0"
+    "0:1.0 0:1.1 -1"
+    "1:1.0 0:1.0 1"
+    "1:1.0 0:1.1 1"
+    "1:1.0 2:1.1 -1"
+    # epoch + sometimes present pkgrel
+    "1:1.0 0:1.0-1 1"
+    "1:1.0-1 0:1.1-1 1"
+    # epoch included on one version
+    "0:1.0 1.0 0"
+    "0:1.1 1.0 1"
+    "0:1.1 1.1 0"
+    "1:1.0 1.0 1"
+    "1:1.0 1.1 1"
+    "1:1.1 1.1 1"
+)
+
+check() {
+    local got
+    got=$("$out/rinse" vercmp "$1" "$2")
+    if [ "$got" != "$3" ]; then
+        echo "FAIL: vercmp $1 $2 = $got, expected $3"
+        failed=$((failed + 1))
+    fi
+    total=$((total + 1))
+}
+
+failed=0
+total=0
+for v in "${vectors[@]}"; do
+    read -r a b want <<< "$v"
+    check "$a" "$b" "$want"
+    check "$b" "$a" "$((-want))"
+done
+
+echo "$((total - failed))/$total comparisons match pacman"
+[ "$failed" -eq 0 ]
@@ -15,10 +15,35 @@
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <fnmatch.h>
+#include <signal.h>
 
 namespace fs = std::filesystem;
 
+extern char** environ;
+
 const char* RESET = "\033[0m";
 const char* BOLD = "\033[1m";
 const char* RED = "\033[31m";
@@ -32,10 +57,18 @@ const char* VERSION_FILE = ".rinse_version";
 
 struct Config {
     bool keep_build = false;
+    int keep_versions = 3;
     bool notify = true;
     bool auto_update = true;
     std::string update_branch = "main";
     std::string outdated_time = "6m";
+    std::string aur_url = "https://aur.archlinux.org";
+    int aur_cache_ttl = 60;
+    std::string aur_clone_url = "https://aur.archlinux.org";
+    int build_jobs = 2;
+    std::string build_cache_dir;    // empty: <cache dir>/packages
+    std::string pacman_conf = "/etc/pacman.conf";
+    int download_mirrors = 3;
 };
 
 Config g_config;
@@ -43,6 +76,8 @@ bool g_dry_run = false;
 bool g_keep = false;
 bool g_full_log = false;
 bool g_auto_confirm = false;
+bool g_offline = false;
+std::string g_dbpath = "/var/lib/pacman";
 
 std::string trim(const std::string& str) {
     size_t first = str.find_first_not_of(" \t\n\r");
@@ -142,75 +177,859 @@ std::string sanitize_config(const std::string& input) {
     return sanitized;
 }
 
-std::string exec(const std::string& cmd) {
-    std::string result;
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) return "";
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), pipe)) {
-        result += buffer;
+std::string sanitize_url(const std::string& input) {
+    std::string sanitized;
+    sanitized.reserve(input.length());
+
+    for (char c : input) {
+        // URLs: alphanumeric plus URL punctuation. Callers single-quote the result, so only quotes must go
+        if (std::isalnum(c) || c == ':' || c == '/' || c == '.' || c == '-' || c == '_' || c == '~' ||
+            c == '%' || c == '?' || c == '=' || c == '&' || c == '@' || c == '+' || c == '[' || c == ']') {
+            sanitized += c;
+        }
+    }
+
+    return sanitized;
+}
+
+std::string json_escape(const std::string& str) {
+    std::string out;
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out;
+}
+
+// SHA-256 (FIPS 180-4), for content hashes and package checksums without
+// linking a crypto library.
+class Sha256 {
+public:
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state_, init, sizeof(state_));
+        length_ = 0;
+        buffered_ = 0;
+    }
+
+    void update(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        length_ += size;
+        if (buffered_ > 0) {
+            size_t take = std::min(size, sizeof(buffer_) - buffered_);
+            memcpy(buffer_ + buffered_, p, take);
+            buffered_ += take;
+            p += take;
+            size -= take;
+            if (buffered_ < sizeof(buffer_)) return;
+            block(buffer_);
+            buffered_ = 0;
+        }
+        for (; size >= 64; p += 64, size -= 64) block(p);
+        memcpy(buffer_, p, size);
+        buffered_ = size;
+    }
+
+    void update(std::string_view data) { update(data.data(), data.size()); }
+
+    std::string hex() {
+        uint64_t bits = length_ * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (buffered_ != 56) update(&pad, 1);
+        uint8_t len[8];
+        for (int i = 0; i < 8; i++) len[i] = bits >> (56 - 8 * i);
+        update(len, 8);
+
+        static const char* digits = "0123456789abcdef";
+        std::string out;
+        for (uint32_t word : state_) {
+            for (int shift = 28; shift >= 0; shift -= 4) out += digits[(word >> shift) & 0xf];
+        }
+        reset();
+        return out;
+    }
+
+    // Hex digest of a file's contents, or "" if it can't be read.
+    static std::string file(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return "";
+        Sha256 sha;
+        std::vector<char> buffer(256 * 1024);
+        ssize_t n;
+        while ((n = read(fd, buffer.data(), buffer.size())) > 0) sha.update(buffer.data(), n);
+        close(fd);
+        return n < 0 ? "" : sha.hex();
+    }
+
+private:
+    uint32_t state_[8];
+    uint64_t length_;
+    uint8_t buffer_[64];
+    size_t buffered_;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void block(const uint8_t* p) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+};
+
+// Records spawned commands and named phases while --trace / RINSE_TRACE is
+// set, and writes them on exit as Chrome trace-event JSON (Perfetto and
+// chrome://tracing both open it). Costs one branch per event when disabled.
+class Tracer {
+public:
+    ~Tracer() { write(); }
+
+    void start(const std::string& path) {
+        path_ = path;
+        pid_ = getpid();
+        epoch_ = std::chrono::steady_clock::now();
+    }
+
+    bool enabled() const { return !path_.empty(); }
+
+    int64_t now_us() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch_).count();
+    }
+
+    // A complete ("X") event; args is a JSON object body without braces.
+    void complete(const std::string& name, const char* cat, int64_t start_us, const std::string& args = "") {
+        if (!enabled()) return;
+        int64_t end_us = now_us();
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream ev;
+        ev << "{\"name\":\"" << json_escape(name) << "\",\"cat\":\"" << cat << "\",\"ph\":\"X\",\"ts\":" << start_us
+           << ",\"dur\":" << (end_us - start_us) << ",\"pid\":" << pid_ << ",\"tid\":" << thread_index()
+           << ",\"args\":{" << args << "}}";
+        events_.push_back(ev.str());
+    }
+
+    void instant(const std::string& name, const char* cat, const std::string& args = "") {
+        if (!enabled()) return;
+        int64_t ts = now_us();
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream ev;
+        ev << "{\"name\":\"" << json_escape(name) << "\",\"cat\":\"" << cat << "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" << ts
+           << ",\"pid\":" << pid_ << ",\"tid\":" << thread_index() << ",\"args\":{" << args << "}}";
+        events_.push_back(ev.str());
+    }
+
+    void write() {
+        // Forked helpers inherit the recorder; only the original process writes.
+        if (!enabled() || getpid() != pid_) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ofstream out(path_, std::ios::trunc);
+        if (!out) {
+            std::cerr << "rinse: could not write trace to " << path_ << std::endl;
+            path_.clear();
+            return;
+        }
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid_ << ",\"args\":{\"name\":\"rinse\"}}";
+        for (const auto& ev : events_) out << ",\n" << ev;
+        out << "\n]}\n";
+        path_.clear();
+    }
+
+private:
+    std::string path_;
+    pid_t pid_ = 0;
+    std::chrono::steady_clock::time_point epoch_;
+    std::mutex mutex_;
+    std::vector<std::string> events_;
+    std::map<std::thread::id, int> threads_;
+
+    int thread_index() {
+        auto it = threads_.emplace(std::this_thread::get_id(), (int)threads_.size() + 1).first;
+        return it->second;
+    }
+};
+
+Tracer g_tracer;
+
+// Times the enclosing scope as a named phase.
+class TracePhase {
+public:
+    explicit TracePhase(const char* name) : name_(name), start_(g_tracer.enabled() ? g_tracer.now_us() : 0) {}
+    ~TracePhase() { g_tracer.complete(name_, "phase", start_); }
+
+private:
+    const char* name_;
+    int64_t start_;
+};
+
+// One spawned command: argv, wall time, exit status and bytes read back.
+struct TraceExec {
+    const std::vector<std::string>& argv;
+    int64_t start = g_tracer.enabled() ? g_tracer.now_us() : 0;
+    int status = 0;
+    size_t bytes = 0;
+
+    ~TraceExec() {
+        if (!g_tracer.enabled() || argv.empty()) return;
+        g_tracer.complete(fs::path(argv[0]).filename().string(), "exec", start,
+                          args(argv) + ",\"status\":" + std::to_string(status) + ",\"bytes\":" + std::to_string(bytes));
+    }
+
+    static std::string args(const std::vector<std::string>& argv) {
+        std::string out = "\"argv\":[";
+        for (size_t i = 0; i < argv.size(); i++) {
+            out += (i ? ",\"" : "\"") + json_escape(argv[i]) + "\"";
+        }
+        return out + "]";
+    }
+};
+
+// Process execution. Commands are argv vectors handed straight to
+// posix_spawnp: no /bin/sh, no quoting, nothing to inject into.
+struct ExecOptions {
+    std::string cwd;
+    bool show_output = false;   // child writes to the terminal (exec_status only)
+    bool merge_stderr = false;  // captured output includes stderr
+};
+
+std::string join_command(const std::vector<std::string>& argv) {
+    std::string out;
+    for (const auto& arg : argv) {
+        if (!out.empty()) out += ' ';
+        out += arg;
+    }
+    return out;
+}
+
+// Starts argv with stdout/stderr wired to out_fd/err_fd (-1 = /dev/null,
+// -2 = inherit). Returns the pid, or -1 if the program couldn't be started.
+pid_t spawn_process(const std::vector<std::string>& argv, const ExecOptions& opts, int out_fd, int err_fd) {
+    if (argv.empty()) return -1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (out_fd == -1) posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    else if (out_fd >= 0) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    if (err_fd == -1) posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    else if (err_fd >= 0) posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    if (!opts.cwd.empty()) posix_spawn_file_actions_addchdir_np(&actions, opts.cwd.c_str());
+
+    std::vector<char*> args;
+    for (const auto& arg : argv) args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(nullptr);
+
+    pid_t pid;
+    int rc = posix_spawnp(&pid, args[0], &actions, nullptr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return rc == 0 ? pid : -1;
+}
+
+int wait_process(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return -1;
+}
+
+// Runs argv and streams its stdout to on_line one line at a time, so large
+// outputs are processed in constant memory. Returns the exit status (127 if
+// the program couldn't be started).
+int exec_lines(const std::vector<std::string>& argv, const std::function<void(const std::string&)>& on_line,
+               const ExecOptions& opts = {}) {
+    TraceExec trace{argv};
+    trace.status = 127;
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return 127;
+
+    pid_t pid = spawn_process(argv, opts, fds[1], opts.merge_stderr ? fds[1] : -1);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return 127;
+    }
+
+    std::vector<char> buffer(64 * 1024);
+    std::string pending;
+    ssize_t n;
+    while ((n = read(fds[0], buffer.data(), buffer.size())) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        trace.bytes += n;
+        size_t start = 0;
+        for (size_t i = 0; i < (size_t)n; i++) {
+            if (buffer[i] != '\n') continue;
+            if (pending.empty()) {
+                on_line(std::string(buffer.data() + start, i - start));
+            } else {
+                pending.append(buffer.data() + start, i - start);
+                on_line(pending);
+                pending.clear();
+            }
+            start = i + 1;
+        }
+        pending.append(buffer.data() + start, n - start);
+    }
+    if (!pending.empty()) on_line(pending);
+    close(fds[0]);
+
+    trace.status = wait_process(pid);
+    return trace.status;
+}
+
+// Runs argv with stdout and stderr on separate pipes and multiplexes them
+// with poll(). Lines (split on \n or \r, so progress redraws count too) go
+// to on_line; on_idle runs whenever idle_ms pass without output.
+int exec_stream(const std::vector<std::string>& argv, const std::function<void(const std::string&, bool)>& on_line,
+                const std::function<void()>& on_idle, int idle_ms, const ExecOptions& opts = {}) {
+    TraceExec trace{argv};
+    trace.status = 127;
+    int out_pipe[2], err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) != 0) return 127;
+    if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return 127;
+    }
+
+    pid_t pid = spawn_process(argv, opts, out_pipe[1], err_pipe[1]);
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    if (pid < 0) {
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        return 127;
+    }
+
+    struct pollfd fds[2] = {{out_pipe[0], POLLIN, 0}, {err_pipe[0], POLLIN, 0}};
+    std::string pending[2];
+    std::vector<char> buffer(64 * 1024);
+    int open_fds = 2;
+
+    while (open_fds > 0) {
+        int ready = poll(fds, 2, idle_ms);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ready == 0) {
+            if (on_idle) on_idle();
+            continue;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ssize_t n = read(fds[i].fd, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (!pending[i].empty()) on_line(pending[i], i == 1);
+                pending[i].clear();
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open_fds--;
+                continue;
+            }
+            trace.bytes += n;
+            for (ssize_t j = 0; j < n; j++) {
+                char c = buffer[j];
+                if (c == '\n' || c == '\r') {
+                    if (!pending[i].empty()) on_line(pending[i], i == 1);
+                    pending[i].clear();
+                } else {
+                    pending[i] += c;
+                }
+            }
+        }
+    }
+
+    for (auto& fd : fds) {
+        if (fd.fd >= 0) close(fd.fd);
     }
-    pclose(pipe);
+    trace.status = wait_process(pid);
+    return trace.status;
+}
+
+std::string exec(const std::vector<std::string>& argv, const ExecOptions& opts = {}) {
+    std::string result;
+    exec_lines(argv, [&](const std::string& line) {
+        result += line;
+        result += '\n';
+    }, opts);
     return result;
 }
 
-int exec_status(const std::string& cmd) {
-    return system(cmd.c_str());
+std::vector<std::string> exec_head(const std::vector<std::string>& argv, size_t count) {
+    std::vector<std::string> lines;
+    exec_lines(argv, [&](const std::string& line) {
+        if (lines.size() < count) lines.push_back(line);
+    });
+    return lines;
+}
+
+int exec_status(const std::vector<std::string>& argv, const ExecOptions& opts = {}) {
+    TraceExec trace{argv};
+    pid_t pid = spawn_process(argv, opts, opts.show_output ? -2 : -1, opts.show_output ? -2 : -1);
+    trace.status = pid < 0 ? 127 : wait_process(pid);
+    return trace.status;
+}
+
+// Starts argv without waiting for it (output discarded). A detached thread
+// reaps it, so it doesn't linger as a zombie in a long-running process like
+// the daemon; if rinse exits first, init inherits it.
+bool exec_background(const std::vector<std::string>& argv) {
+    g_tracer.instant(argv.empty() ? "" : argv[0], "exec", TraceExec::args(argv));
+    pid_t pid = spawn_process(argv, {}, -1, -1);
+    if (pid <= 0) return false;
+    std::thread([pid]() { wait_process(pid); }).detach();
+    return true;
 }
 
+// PATH lookup without spawning anything.
 bool check_command(const std::string& cmd) {
-    return exec_status("command -v " + cmd + " >/dev/null 2>&1") == 0;
+    const char* path = getenv("PATH");
+    std::string dirs = path ? path : "/usr/local/bin:/usr/bin:/bin";
+    size_t start = 0;
+    while (start <= dirs.size()) {
+        size_t end = dirs.find(':', start);
+        if (end == std::string::npos) end = dirs.size();
+        std::string dir = dirs.substr(start, end - start);
+        if (dir.empty()) dir = ".";
+        if (access((dir + "/" + cmd).c_str(), X_OK) == 0) return true;
+        start = end + 1;
+    }
+    return false;
 }
 
 bool check_flatpak() {
     return check_command("flatpak");
 }
 
+// Runs fn(0..count-1) on a bounded pool of worker threads.
+void parallel_for(size_t count, const std::function<void(size_t)>& fn, size_t max_workers = 8) {
+    size_t workers = std::min({count, max_workers, (size_t)std::max(1u, std::thread::hardware_concurrency())});
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (size_t w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) fn(i);
+        });
+    }
+    for (auto& t : pool) t.join();
+}
+
 std::string get_home() {
     const char* home = getenv("HOME");
     return home ? home : "/root";
 }
 
+std::string get_cache_dir() {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) return std::string(xdg) + "/rinse";
+    return get_home() + "/.cache/rinse";
+}
+
+std::string format_date(time_t timestamp) {
+    char buf[64];
+    strftime(buf, sizeof(buf), "%d %B %Y", localtime(&timestamp));
+    return buf;
+}
+
 void send_notification(const std::string& msg) {
+    TracePhase phase("notify");
     if (g_config.notify && check_command("notify-send")) {
-        exec_status("notify-send 'rinse' '" + sanitize_message(msg) + "' 2>/dev/null");
+        exec_status({"notify-send", "rinse", sanitize_message(msg)});
     }
 }
 
-std::string get_installed_flatpak_id(const std::string& pkg) {
-    if (!check_flatpak()) return "";
+struct FlatpakApp {
+    std::string id;
+    std::string name;
+    std::string arch;
+    std::string branch;
+    bool user = false;
+};
+
+std::string to_lower(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
+
+// Installed flatpak apps, read straight from the installation directories
+// (<dir>/app/<id>/current -> <arch>/<branch>). FLATPAK_SYSTEM_DIR and
+// FLATPAK_USER_DIR override the default locations, like they do for flatpak.
+class FlatpakIndex {
+public:
+    void load(const std::string& system_dir, const std::string& user_dir) {
+        apps_.clear();
+        scan(system_dir, false);
+        scan(user_dir, true);
+    }
+
+    // Case-insensitive: exact app ID, then exact name, then substring of either.
+    const FlatpakApp* find(const std::string& query) const {
+        std::string needle = to_lower(query);
+        if (needle.empty()) return nullptr;
+
+        for (const auto& app : apps_) {
+            if (app.lower_id == needle) return &app.app;
+        }
+        for (const auto& app : apps_) {
+            if (app.lower_name == needle) return &app.app;
+        }
+        for (const auto& app : apps_) {
+            if (app.lower_id.find(needle) != std::string::npos || app.lower_name.find(needle) != std::string::npos) {
+                return &app.app;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t size() const { return apps_.size(); }
+
+private:
+    struct Entry {
+        FlatpakApp app;
+        std::string lower_id;
+        std::string lower_name;
+    };
+    std::vector<Entry> apps_;
+
+    void scan(const std::string& dir, bool user) {
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir + "/app", ec)) {
+            fs::path current = entry.path() / "current";
+            if (!fs::exists(current / "active", ec)) continue;
+
+            FlatpakApp app;
+            app.id = entry.path().filename().string();
+            app.user = user;
+            fs::path ref = fs::read_symlink(current, ec);
+            if (!ec) {
+                app.arch = ref.parent_path().string();
+                app.branch = ref.filename().string();
+            }
+            app.name = desktop_name(current / "active" / "export" / "share" / "applications" / (app.id + ".desktop"));
+            if (app.name.empty()) app.name = app.id;
+
+            apps_.push_back({app, to_lower(app.id), to_lower(app.name)});
+        }
+    }
+
+    static std::string desktop_name(const fs::path& path) {
+        std::ifstream file(path);
+        std::string line;
+        bool in_entry = false;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line[0] == '[') {
+                in_entry = (line == "[Desktop Entry]");
+            } else if (in_entry && line.compare(0, 5, "Name=") == 0) {
+                return trim(line.substr(5));
+            }
+        }
+        return "";
+    }
+};
 
-    // Use --columns=application to get only the app ID
-    std::string result = exec("flatpak list --app --columns=application 2>/dev/null | grep -i '" + sanitize_package(pkg) + "' | head -1");
+std::unique_ptr<FlatpakIndex> g_flatpak_index;
 
-    if (!result.empty()) {
-        result = trim(result);
-        return sanitize_package(result);
+const FlatpakIndex& flatpak_index() {
+    if (!g_flatpak_index) {
+        TracePhase phase("flatpak index");
+        const char* system_dir = getenv("FLATPAK_SYSTEM_DIR");
+        const char* user_dir = getenv("FLATPAK_USER_DIR");
+        g_flatpak_index = std::make_unique<FlatpakIndex>();
+        g_flatpak_index->load(system_dir && *system_dir ? system_dir : "/var/lib/flatpak",
+                              user_dir && *user_dir ? user_dir : get_home() + "/.local/share/flatpak");
     }
+    return *g_flatpak_index;
+}
+
+std::string get_installed_flatpak_id(const std::string& pkg) {
+    const FlatpakApp* app = flatpak_index().find(sanitize_package(pkg));
+    return app ? sanitize_package(app->id) : "";
+}
 
-    return "";
+std::string time_ago(time_t pkg_time) {
+    int days = difftime(time(nullptr), pkg_time) / 86400;
+
+    if (days == 0) return "today";
+    if (days == 1) return "1 day ago";
+    if (days < 30) return std::to_string(days) + " days ago";
+    if (days < 365) return std::to_string(days / 30) + " months ago";
+    return std::to_string(days / 365) + " years ago";
 }
 
 std::string time_ago(const std::string& date_str) {
-    time_t now = time(nullptr);
     struct tm tm_date = {};
 
     if (strptime(date_str.c_str(), "%d %B %Y", &tm_date) ||
         strptime(date_str.c_str(), "%Y-%m-%d", &tm_date)) {
-        time_t pkg_time = mktime(&tm_date);
-        double diff = difftime(now, pkg_time);
-        int days = diff / 86400;
-
-        if (days == 0) return "today";
-        if (days == 1) return "1 day ago";
-        if (days < 30) return std::to_string(days) + " days ago";
-        if (days < 365) return std::to_string(days / 30) + " months ago";
-        return std::to_string(days / 365) + " years ago";
+        return time_ago(mktime(&tm_date));
     }
 
     return "unknown";
 }
 
+// Minimal JSON reader, enough for the AUR RPC and GitHub API responses.
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string str;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    const JsonValue* get(const std::string& key) const {
+        for (const auto& m : members) {
+            if (m.first == key) return &m.second;
+        }
+        return nullptr;
+    }
+
+    std::string get_string(const std::string& key) const {
+        const JsonValue* v = get(key);
+        return v && v->type == String ? v->str : "";
+    }
+
+    long long get_int(const std::string& key) const {
+        const JsonValue* v = get(key);
+        return v && v->type == Number ? (long long)v->number : 0;
+    }
+
+    std::vector<std::string> get_strings(const std::string& key) const {
+        std::vector<std::string> out;
+        const JsonValue* v = get(key);
+        if (v && v->type == Array) {
+            for (const auto& item : v->items) {
+                if (item.type == String) out.push_back(item.str);
+            }
+        }
+        return out;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : s_(text) {}
+
+    bool parse(JsonValue& out) {
+        if (!value(out, 0)) return false;
+        skip_ws();
+        return pos_ == s_.size();
+    }
+
+private:
+    const std::string& s_;
+    size_t pos_ = 0;
+
+    void skip_ws() {
+        while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' || s_[pos_] == '\n' || s_[pos_] == '\r')) pos_++;
+    }
+
+    bool literal(const char* word) {
+        size_t n = strlen(word);
+        if (s_.compare(pos_, n, word) != 0) return false;
+        pos_ += n;
+        return true;
+    }
+
+    static void put_utf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) {
+            out += (char)cp;
+        } else if (cp < 0x800) {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        } else {
+            out += (char)(0xF0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    bool hex4(unsigned& cp) {
+        if (pos_ + 4 > s_.size()) return false;
+        cp = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = s_[pos_++];
+            cp <<= 4;
+            if (c >= '0' && c <= '9') cp |= c - '0';
+            else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    bool string(std::string& out) {
+        if (s_[pos_] != '"') return false;
+        pos_++;
+        while (pos_ < s_.size()) {
+            char c = s_[pos_++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= s_.size()) return false;
+            char e = s_[pos_++];
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned cp;
+                    if (!hex4(cp)) return false;
+                    if (cp >= 0xD800 && cp <= 0xDBFF && s_.compare(pos_, 2, "\\u") == 0) {
+                        pos_ += 2;
+                        unsigned lo;
+                        if (!hex4(lo)) return false;
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    }
+                    put_utf8(out, cp);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return false;
+    }
+
+    bool value(JsonValue& out, int depth) {
+        if (depth > 64) return false;
+        skip_ws();
+        if (pos_ >= s_.size()) return false;
+
+        char c = s_[pos_];
+        if (c == '{') {
+            out.type = JsonValue::Object;
+            pos_++;
+            skip_ws();
+            if (pos_ < s_.size() && s_[pos_] == '}') { pos_++; return true; }
+            while (true) {
+                skip_ws();
+                std::string key;
+                if (pos_ >= s_.size() || !string(key)) return false;
+                skip_ws();
+                if (pos_ >= s_.size() || s_[pos_++] != ':') return false;
+                out.members.emplace_back(std::move(key), JsonValue());
+                if (!value(out.members.back().second, depth + 1)) return false;
+                skip_ws();
+                if (pos_ >= s_.size()) return false;
+                if (s_[pos_] == ',') { pos_++; continue; }
+                if (s_[pos_] == '}') { pos_++; return true; }
+                return false;
+            }
+        }
+        if (c == '[') {
+            out.type = JsonValue::Array;
+            pos_++;
+            skip_ws();
+            if (pos_ < s_.size() && s_[pos_] == ']') { pos_++; return true; }
+            while (true) {
+                out.items.emplace_back();
+                if (!value(out.items.back(), depth + 1)) return false;
+                skip_ws();
+                if (pos_ >= s_.size()) return false;
+                if (s_[pos_] == ',') { pos_++; continue; }
+                if (s_[pos_] == ']') { pos_++; return true; }
+                return false;
+            }
+        }
+        if (c == '"') {
+            out.type = JsonValue::String;
+            return string(out.str);
+        }
+        if (literal("true")) { out.type = JsonValue::Bool; out.boolean = true; return true; }
+        if (literal("false")) { out.type = JsonValue::Bool; return true; }
+        if (literal("null")) { out.type = JsonValue::Null; return true; }
+
+        const char* start = s_.c_str() + pos_;
+        char* end = nullptr;
+        out.number = std::strtod(start, &end);
+        if (end == start) return false;
+        out.type = JsonValue::Number;
+        pos_ += end - start;
+        return true;
+    }
+};
+
+bool parse_json(const std::string& text, JsonValue& out) {
+    out = JsonValue();
+    return JsonParser(text).parse(out);
+}
+
 int parse_time_value(const std::string& val) {
     std::regex re("(\\d+)([dmy])");
     std::smatch match;
@@ -232,14 +1051,16 @@ void load_config() {
         fs::create_directories(get_home() + "/.config/rinse");
 
         // Try to download from GitHub
-        std::string download_cmd = "curl -s https://raw.githubusercontent.com/Rousevv/rinse/main/rinse.conf -o " + config_path + " 2>/dev/null";
-        if (exec_status(download_cmd) != 0) {
+        if (exec_status({"curl", "-sf", "https://raw.githubusercontent.com/Rousevv/rinse/main/rinse.conf", "-o", config_path}) != 0) {
             // Create default config if download fails
             std::ofstream file(config_path);
             file << "# rinse configuration file\n\n";
             file << "# Keep build files after AUR installation\n";
-            file << "# If true, build directories will be kept in /tmp for debugging\n";
+            file << "# If true, makepkg's src/ and pkg/ directories are kept in\n";
+            file << "# ~/.cache/rinse/aur-build/<package> for debugging\n";
             file << "keep_build = false\n\n";
+            file << "# Versions of each package 'rinse clean' keeps in the package caches\n";
+            file << "keep_versions = 3\n\n";
             file << "# Send desktop notifications when operations complete\n";
             file << "# Requires notify-send to be installed\n";
             file << "notify = true\n\n";
@@ -251,7 +1072,22 @@ void load_config() {
             file << "update_branch = main\n\n";
             file << "# Default time threshold for 'rinse outdated' command\n";
             file << "# Format: Nd (days), Nm (months), Ny (years)\n";
-            file << "outdated_time = 6m\n";
+            file << "outdated_time = 6m\n\n";
+            file << "# AUR server used for package lookups\n";
+            file << "aur_url = https://aur.archlinux.org\n\n";
+            file << "# Minutes before cached AUR lookups are refreshed (0 disables the cache)\n";
+            file << "aur_cache_ttl = 60\n\n";
+            file << "# Where AUR build files are cloned from (<url>/<pkgbase>.git)\n";
+            file << "aur_clone_url = https://aur.archlinux.org\n\n";
+            file << "# Number of AUR packages built at the same time\n";
+            file << "build_jobs = 2\n\n";
+            file << "# Where built AUR packages are kept for reuse. Point several machines at\n";
+            file << "# the same (e.g. NFS-mounted) directory to share builds between them\n";
+            file << "build_cache_dir = ~/.cache/rinse/packages\n\n";
+            file << "# pacman configuration read for repos and mirrors\n";
+            file << "pacman_conf = /etc/pacman.conf\n\n";
+            file << "# Mirrors per repo rinse downloads packages from at once (0 leaves downloading to pacman)\n";
+            file << "download_mirrors = 3\n";
             file.close();
         }
     }
@@ -263,7 +1099,11 @@ void load_config() {
         line = trim(line);
         if (line.empty() || line[0] == '#') continue;
 
+        // "//" only starts a comment at the beginning or after whitespace, so URLs survive
         size_t comment = line.find("//");
+        while (comment != std::string::npos && comment > 0 && line[comment - 1] != ' ' && line[comment - 1] != '\t') {
+            comment = line.find("//", comment + 2);
+        }
         if (comment != std::string::npos) {
             line = line.substr(0, comment);
             line = trim(line);
@@ -275,373 +1115,3402 @@ void load_config() {
             std::string val = trim(line.substr(eq + 1));
 
             if (key == "keep_build") g_config.keep_build = (val == "true");
+            else if (key == "keep_versions") g_config.keep_versions = std::max(0, std::atoi(val.c_str()));
             else if (key == "notify") g_config.notify = (val == "true");
             else if (key == "auto_update") g_config.auto_update = (val == "true");
             else if (key == "update_branch") g_config.update_branch = sanitize_config(val);
             else if (key == "outdated_time") g_config.outdated_time = sanitize_config(val);
+            else if (key == "aur_url") g_config.aur_url = sanitize_url(val);
+            else if (key == "aur_cache_ttl") g_config.aur_cache_ttl = std::max(0, std::atoi(val.c_str()));
+            else if (key == "aur_clone_url") g_config.aur_clone_url = sanitize_url(val);
+            else if (key == "build_jobs") g_config.build_jobs = std::max(1, std::atoi(val.c_str()));
+            else if (key == "pacman_conf") g_config.pacman_conf = sanitize_path(val);
+            else if (key == "download_mirrors") g_config.download_mirrors = std::max(0, std::atoi(val.c_str()));
+            else if (key == "build_cache_dir") {
+                if (val.rfind("~/", 0) == 0) val = get_home() + val.substr(1);
+                g_config.build_cache_dir = sanitize_path(val);
+            }
         }
     }
 }
 
-std::string get_package_date_pacman(const std::string& pkg) {
-    std::string cmd = "pacman -Si " + sanitize_package(pkg) + " 2>/dev/null | grep 'Build Date' | cut -d: -f2-";
-    return trim(exec(cmd));
-}
-
-std::string get_package_date_aur(const std::string& pkg) {
-    std::string cmd = "curl -s 'https://aur.archlinux.org/rpc/?v=5&type=info&arg=" + sanitize_package(pkg) +
-                     "' | grep -o '\"LastModified\":[0-9]*' | cut -d: -f2";
-    std::string result = exec(cmd);
-    if (!result.empty()) {
-        time_t timestamp = std::stoll(result);
-        char buf[64];
-        strftime(buf, sizeof(buf), "%d %B %Y", localtime(&timestamp));
-        return buf;
+// pacman's version ordering (alpm_pkg_vercmp). Runs of digits compare
+// numerically and runs of letters lexically; separators only mark where a
+// run ends. Returns <0, 0 or >0 like strcmp.
+int rpmvercmp(std::string_view a, std::string_view b) {
+    if (a == b) return 0;
+    auto alnum = [](char c) { return std::isalnum((unsigned char)c) != 0; };
+    auto digit = [](char c) { return std::isdigit((unsigned char)c) != 0; };
+    auto alpha = [](char c) { return std::isalpha((unsigned char)c) != 0; };
+
+    size_t one = 0, two = 0, end1 = 0, end2 = 0;
+    while (one < a.size() && two < b.size()) {
+        while (one < a.size() && !alnum(a[one])) one++;
+        while (two < b.size() && !alnum(b[two])) two++;
+        if (one == a.size() || two == b.size()) break;
+
+        // Different separator lengths decide it on their own.
+        if (one - end1 != two - end2) return one - end1 < two - end2 ? -1 : 1;
+
+        end1 = one;
+        end2 = two;
+        bool numeric = digit(a[one]);
+        auto in_run = numeric ? digit : alpha;
+        while (end1 < a.size() && in_run(a[end1])) end1++;
+        while (end2 < b.size() && in_run(b[end2])) end2++;
+
+        // A numeric run is newer than an alphabetic one.
+        if (end2 == two) return numeric ? 1 : -1;
+
+        std::string_view run1 = a.substr(one, end1 - one);
+        std::string_view run2 = b.substr(two, end2 - two);
+        if (numeric) {
+            run1.remove_prefix(std::min(run1.find_first_not_of('0'), run1.size()));
+            run2.remove_prefix(std::min(run2.find_first_not_of('0'), run2.size()));
+            if (run1.size() != run2.size()) return run1.size() < run2.size() ? -1 : 1;
+        }
+        int cmp = run1.compare(run2);
+        if (cmp != 0) return cmp < 0 ? -1 : 1;
+        one = end1;
+        two = end2;
     }
-    return "";
+    if (one == a.size() && two == b.size()) return 0;
+    // A trailing letter run ("1.0a" vs "1.0") is older; anything else is newer.
+    if ((one == a.size() && !alpha(b[two])) || (one < a.size() && alpha(a[one]))) return -1;
+    return 1;
 }
 
-bool is_installed(const std::string& pkg) {
-    return exec_status("pacman -Q " + sanitize_package(pkg) + " >/dev/null 2>&1") == 0;
+// Compares full "[epoch:]pkgver[-pkgrel]" versions.
+int vercmp(std::string_view a, std::string_view b) {
+    if (a == b) return 0;
+    struct Evr {
+        std::string_view epoch = "0", version, release;
+        bool has_release = false;
+    };
+    auto split = [](std::string_view evr) {
+        Evr out;
+        size_t digits = 0;
+        while (digits < evr.size() && std::isdigit((unsigned char)evr[digits])) digits++;
+        if (digits < evr.size() && evr[digits] == ':') {
+            if (digits > 0) out.epoch = evr.substr(0, digits);
+            evr.remove_prefix(digits + 1);
+        }
+        size_t dash = evr.rfind('-');
+        if (dash != std::string_view::npos) {
+            out.release = evr.substr(dash + 1);
+            out.has_release = true;
+            evr = evr.substr(0, dash);
+        }
+        out.version = evr;
+        return out;
+    };
+    Evr x = split(a), y = split(b);
+    int cmp = rpmvercmp(x.epoch, y.epoch);
+    if (cmp == 0) cmp = rpmvercmp(x.version, y.version);
+    if (cmp == 0 && x.has_release && y.has_release) cmp = rpmvercmp(x.release, y.release);
+    return cmp;
 }
 
-bool is_outdated(const std::string& pkg) {
-    return exec_status("pacman -Qu 2>/dev/null | grep -q '^" + sanitize_package(pkg) + " '") == 0;
-}
+// "<name>-<pkgver>-<pkgrel>-<arch>.pkg.tar.<ext>", as pacman and makepkg
+// name package files. Returns false for anything else.
+struct PackageFileName {
+    std::string name;
+    std::string version;    // "[epoch:]pkgver-pkgrel"
+    std::string arch;
+};
 
-bool package_in_pacman(const std::string& pkg) {
-    return exec_status("pacman -Si " + sanitize_package(pkg) + " >/dev/null 2>&1") == 0;
+bool parse_package_file_name(const std::string& file, PackageFileName& out) {
+    size_t ext = file.find(".pkg.tar");
+    if (ext == std::string::npos || ext == 0) return false;
+    size_t dashes[3];
+    size_t cut = ext;
+    for (size_t& dash : dashes) {
+        if (cut == 0 || (cut = file.rfind('-', cut - 1)) == std::string::npos || cut == 0) return false;
+        dash = cut;
+    }
+    out.name = file.substr(0, dashes[2]);
+    out.version = file.substr(dashes[2] + 1, dashes[0] - dashes[2] - 1);
+    out.arch = file.substr(dashes[0] + 1, ext - dashes[0] - 1);
+    return true;
 }
 
-std::string fuzzy_search_package(const std::string& query) {
-    std::string all_pkgs = exec("pacman -Q");
-    std::istringstream iss(all_pkgs);
-    std::string line;
-
-    std::vector<std::pair<std::string, int>> matches;
+// "foo>=1.2" -> "foo"
+std::string dependency_name(const std::string& dep) {
+    return dep.substr(0, dep.find_first_of("<>="));
+}
 
-    while (std::getline(iss, line)) {
-        std::string pkg_name = line.substr(0, line.find(' '));
-        std::string lower_pkg = pkg_name;
-        std::string lower_query = query;
-        std::transform(lower_pkg.begin(), lower_pkg.end(), lower_pkg.begin(), ::tolower);
-        std::transform(lower_query.begin(), lower_query.end(), lower_query.begin(), ::tolower);
+struct LocalPackage {
+    std::string name;
+    std::string version;
+    std::string desc;
+    time_t build_date = 0;
+    time_t install_date = 0;
+    uint64_t size = 0;          // installed size
+    bool explicit_install = true;
+    std::vector<std::string> depends;
+    std::vector<std::string> optdepends;    // "name: why"
+    std::vector<std::string> provides;
+    std::vector<std::string> replaces;
+};
 
-        if (lower_pkg.find(lower_query) != std::string::npos) {
-            int score = 100 - std::abs((int)lower_pkg.length() - (int)lower_query.length());
-            matches.push_back({pkg_name, score});
+// In-memory copy of the pacman local database (<dbpath>/local/*/desc),
+// loaded once per run so installed-package queries never fork pacman.
+class LocalDB {
+public:
+    bool load(const std::string& dbpath) {
+        pkgs_.clear();
+        std::string local_dir = dbpath + "/local";
+        std::error_code ec;
+        if (!fs::is_directory(local_dir, ec)) return false;
+
+        for (const auto& entry : fs::directory_iterator(local_dir, ec)) {
+            if (!entry.is_directory(ec)) continue;
+            LocalPackage pkg;
+            if (parse_desc(entry.path().string() + "/desc", pkg)) {
+                pkgs_.push_back(std::move(pkg));
+            }
         }
+
+        std::sort(pkgs_.begin(), pkgs_.end(),
+                  [](const LocalPackage& a, const LocalPackage& b) { return a.name < b.name; });
+        return true;
     }
 
-    if (!matches.empty()) {
-        std::sort(matches.begin(), matches.end(),
-                  [](const auto& a, const auto& b) { return a.second > b.second; });
-        return matches[0].first;
+    const LocalPackage* find(const std::string& name) const {
+        auto it = std::lower_bound(pkgs_.begin(), pkgs_.end(), name,
+                                   [](const LocalPackage& p, const std::string& n) { return p.name < n; });
+        if (it == pkgs_.end() || it->name != name) return nullptr;
+        return &*it;
     }
 
-    return "";
-}
+    const std::vector<LocalPackage>& packages() const { return pkgs_; }
+
+private:
+    std::vector<LocalPackage> pkgs_;
+
+    static bool parse_desc(const std::string& path, LocalPackage& pkg) {
+        std::ifstream file(path);
+        if (!file) return false;
+
+        std::string line, section;
+        while (std::getline(file, line)) {
+            if (line.empty()) {
+                section.clear();
+            } else if (line.size() > 2 && line.front() == '%' && line.back() == '%') {
+                section = line;
+            } else if (section == "%NAME%") {
+                pkg.name = line;
+            } else if (section == "%VERSION%") {
+                pkg.version = line;
+            } else if (section == "%DESC%") {
+                pkg.desc = line;
+            } else if (section == "%BUILDDATE%") {
+                pkg.build_date = std::strtoll(line.c_str(), nullptr, 10);
+            } else if (section == "%INSTALLDATE%") {
+                pkg.install_date = std::strtoll(line.c_str(), nullptr, 10);
+            } else if (section == "%REASON%") {
+                pkg.explicit_install = (line == "0");
+            } else if (section == "%DEPENDS%") {
+                pkg.depends.push_back(line);
+            } else if (section == "%SIZE%") {
+                pkg.size = std::strtoull(line.c_str(), nullptr, 10);
+            } else if (section == "%OPTDEPENDS%") {
+                pkg.optdepends.push_back(line);
+            } else if (section == "%PROVIDES%") {
+                pkg.provides.push_back(line);
+            } else if (section == "%REPLACES%") {
+                pkg.replaces.push_back(line);
+            }
+        }
 
-bool package_in_aur(const std::string& pkg) {
-    return exec_status("curl -s 'https://aur.archlinux.org/rpc/?v=5&type=info&arg=" + sanitize_package(pkg) +
-                      "' | grep -q '\"resultcount\":1'") == 0;
-}
+        return !pkg.name.empty();
+    }
+};
 
-bool package_in_flatpak(const std::string& pkg) {
-    if (!check_flatpak()) return false;
-    std::string result = exec("flatpak search " + sanitize_package(pkg) + " 2>/dev/null | head -1");
-    return !result.empty() && result.find("No matches") == std::string::npos && result.find("Application") == std::string::npos;
-}
+std::unique_ptr<LocalDB> g_local_db;
 
-std::string search_flatpak(const std::string& pkg) {
-    if (!check_flatpak()) return "";
-    std::string result = exec("flatpak search " + sanitize_package(pkg) + " 2>/dev/null | head -5");
-    return result;
+const LocalDB& local_db() {
+    if (!g_local_db) {
+        TracePhase phase("local db");
+        g_local_db = std::make_unique<LocalDB>();
+        if (!g_local_db->load(g_dbpath)) {
+            std::cerr << RED << "Could not read pacman database at " << g_dbpath << "/local" << RESET << std::endl;
+        }
+    }
+    return *g_local_db;
 }
 
-std::string get_flatpak_package_id(const std::string& pkg) {
-    if (!check_flatpak()) return "";
-    std::string result = exec("flatpak search " + sanitize_package(pkg) + " 2>/dev/null | head -2 | tail -1");
-    if (result.empty() || result.find("No matches") != std::string::npos) return "";
+// Dependency graph over the local DB, in CSR form. Package i's
+// dependencies are the slots slot_start_[i] .. slot_start_[i + 1], and
+// slot s is satisfied by sats_[sat_start_[s] .. sat_start_[s + 1]]: the
+// package of that name and every package providing it, or failing both,
+// any package that replaces it. Reverse edges (who needs i, hard and
+// optional) are stored the same way. Versions in dependencies are not
+// checked; for orphan and removal questions the names are what matter.
+class DepGraph {
+public:
+    void build(const LocalDB& db) {
+        db_ = &db;
+        const auto& pkgs = db.packages();
+        std::unordered_map<std::string, std::vector<uint32_t>> providers, replacers;
+        for (uint32_t i = 0; i < pkgs.size(); i++) {
+            for (const auto& provided : pkgs[i].provides) providers[dependency_name(provided)].push_back(i);
+            for (const auto& replaced : pkgs[i].replaces) replacers[dependency_name(replaced)].push_back(i);
+        }
+        auto satisfiers = [&](const std::string& name, std::vector<uint32_t>& out) {
+            size_t first = out.size();
+            if (const LocalPackage* pkg = db.find(name)) out.push_back(pkg - pkgs.data());
+            auto it = providers.find(name);
+            if (it != providers.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+            if (out.size() == first) {
+                it = replacers.find(name);
+                if (it != replacers.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+            }
+            std::sort(out.begin() + first, out.end());
+            out.erase(std::unique(out.begin() + first, out.end()), out.end());
+        };
+
+        std::vector<std::pair<uint32_t, uint32_t>> hard, optional;    // (needed, needed by)
+        slot_start_.assign(1, 0);
+        sat_start_.assign(1, 0);
+        sats_.clear();
+        slot_names_.clear();
+        for (uint32_t i = 0; i < pkgs.size(); i++) {
+            for (const auto& dep : pkgs[i].depends) {
+                slot_names_.push_back(dependency_name(dep));
+                size_t first = sats_.size();
+                satisfiers(slot_names_.back(), sats_);
+                for (size_t k = first; k < sats_.size(); k++) {
+                    if (sats_[k] != i) hard.push_back({sats_[k], i});
+                }
+                sat_start_.push_back(sats_.size());
+            }
+            slot_start_.push_back(slot_names_.size());
+
+            std::vector<uint32_t> opt;
+            for (const auto& dep : pkgs[i].optdepends) {
+                opt.clear();
+                satisfiers(dependency_name(dep.substr(0, dep.find(':'))), opt);
+                for (uint32_t target : opt) {
+                    if (target != i) optional.push_back({target, i});
+                }
+            }
+        }
+        to_csr(hard, pkgs.size(), rdep_start_, rdeps_);
+        to_csr(optional, pkgs.size(), ropt_start_, ropts_);
+    }
 
-    // Extract the package ID (third column, typically format: org.example.App)
-    std::istringstream iss(result);
-    std::string name, description, package_id;
+    size_t size() const { return slot_start_.size() - 1; }
+    const LocalPackage& package(size_t i) const { return db_->packages()[i]; }
 
-    // Skip first two columns (name and description) to get to package ID
-    std::getline(iss, name, '\t');
-    std::getline(iss, description, '\t');
-    std::getline(iss, package_id, '\t');
+    // Index of an installed package, or -1.
+    long index(const std::string& name) const {
+        const LocalPackage* pkg = db_->find(name);
+        return pkg ? pkg - db_->packages().data() : -1;
+    }
 
-    package_id = trim(package_id);
+    // pacman -Qtd: installed as a dependency, and nothing installed needs
+    // it, not even optionally.
+    std::vector<size_t> orphans() const {
+        std::vector<size_t> out;
+        for (size_t i = 0; i < size(); i++) {
+            if (!package(i).explicit_install && rdep_start_[i] == rdep_start_[i + 1] && ropt_start_[i] == ropt_start_[i + 1]) {
+                out.push_back(i);
+            }
+        }
+        return out;
+    }
 
-    // Sanitize the package ID before returning it
-    return sanitize_package(package_id);
-}
-bool confirm(const std::string& prompt, bool default_yes = true) {
-    if (g_auto_confirm) return true;
+    // What pacman -R (or -Rs with recursive) removes for these targets:
+    // with -s, also every dependency that was installed as one and is
+    // needed by nothing outside the set, repeated until nothing changes.
+    std::vector<size_t> removal_set(const std::vector<size_t>& targets, bool recursive) const {
+        std::vector<char> removing(size(), 0);
+        std::vector<size_t> out;
+        for (size_t t : targets) {
+            if (!removing[t]) out.push_back(t);
+            removing[t] = 1;
+        }
+        for (bool changed = recursive; changed;) {
+            changed = false;
+            for (size_t n = 0; n < out.size(); n++) {
+                size_t i = out[n];
+                for (uint32_t s = slot_start_[i]; s < slot_start_[i + 1]; s++) {
+                    for (uint32_t k = sat_start_[s]; k < sat_start_[s + 1]; k++) {
+                        uint32_t dep = sats_[k];
+                        if (removing[dep] || package(dep).explicit_install) continue;
+                        bool needed = false;
+                        for (uint32_t r = rdep_start_[dep]; r < rdep_start_[dep + 1] && !needed; r++) {
+                            needed = !removing[rdeps_[r]];
+                        }
+                        if (needed) continue;
+                        removing[dep] = 1;
+                        out.push_back(dep);
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return out;
+    }
+
+    struct Break {
+        size_t package;         // stays installed
+        std::string needs;      // dependency left without a satisfier
+    };
+
+    // Installed packages outside the removal set that would lose a dependency.
+    std::vector<Break> broken_by(const std::vector<size_t>& removal) const {
+        std::vector<char> removing(size(), 0);
+        for (size_t i : removal) removing[i] = 1;
+        std::vector<char> checked(size(), 0);
+        std::vector<Break> out;
+        for (size_t i : removal) {
+            for (uint32_t r = rdep_start_[i]; r < rdep_start_[i + 1]; r++) {
+                uint32_t user = rdeps_[r];
+                if (removing[user] || checked[user]) continue;
+                checked[user] = 1;
+                for (uint32_t s = slot_start_[user]; s < slot_start_[user + 1]; s++) {
+                    bool left = sat_start_[s] == sat_start_[s + 1];
+                    for (uint32_t k = sat_start_[s]; k < sat_start_[s + 1] && !left; k++) left = !removing[sats_[k]];
+                    if (!left) out.push_back({user, slot_names_[s]});
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+    const LocalDB* db_ = nullptr;
+    std::vector<uint32_t> slot_start_;
+    std::vector<std::string> slot_names_;
+    std::vector<uint32_t> sat_start_, sats_;
+    std::vector<uint32_t> rdep_start_, rdeps_;
+    std::vector<uint32_t> ropt_start_, ropts_;
+
+    static void to_csr(std::vector<std::pair<uint32_t, uint32_t>>& edges, size_t nodes, std::vector<uint32_t>& start,
+                       std::vector<uint32_t>& targets) {
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        start.assign(nodes + 1, 0);
+        for (const auto& edge : edges) start[edge.first + 1]++;
+        for (size_t i = 0; i < nodes; i++) start[i + 1] += start[i];
+        targets.resize(edges.size());
+        for (size_t k = 0; k < edges.size(); k++) targets[k] = edges[k].second;
+    }
+};
+
+std::unique_ptr<DepGraph> g_dep_graph;
+
+const DepGraph& dep_graph() {
+    if (!g_dep_graph) {
+        const LocalDB& db = local_db();
+        TracePhase phase("dep graph");
+        g_dep_graph = std::make_unique<DepGraph>();
+        g_dep_graph->build(db);
+    }
+    return *g_dep_graph;
+}
+
+struct SyncPackage {
+    std::string repo;
+    std::string name;
+    std::string version;
+    std::string filename;
+    time_t build_date = 0;
+    uint64_t csize = 0;
+    uint64_t isize = 0;
+    std::vector<std::string> depends;
+    std::vector<std::string> provides;
+};
+
+struct PacmanRepo {
+    std::string name;
+    std::vector<std::string> servers;    // $repo and $arch filled in
+    std::vector<std::string> includes;   // mirrorlists some of them came from
+    std::string arch;
+};
+
+// What pacman's "Architecture = auto" resolves to.
+std::string machine_arch() {
+    struct utsname uts;
+    return uname(&uts) == 0 ? uts.machine : "x86_64";
+}
+
+// Repos from pacman.conf in order, with their mirrors from Server lines and
+// Include'd mirrorlists.
+std::vector<PacmanRepo> pacman_repos(const std::string& conf_path) {
+    std::vector<PacmanRepo> repos;
+    std::string arch;
+    std::vector<std::string> servers;    // of the current section, before substitution
+
+    auto read_lines = [](const std::string& path, const std::function<void(const std::string&, const std::string&)>& fn) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            line = trim(line.substr(0, line.find('#')));
+            size_t eq = line.find('=');
+            if (eq == std::string::npos) fn(line, "");
+            else fn(trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+        }
+    };
+    auto finish = [&]() {
+        if (repos.empty()) return;
+        if (arch.empty() || arch == "auto") arch = machine_arch();
+        for (const auto& server : servers) {
+            std::string url = server;
+            for (auto [var, val] : {std::pair<std::string, std::string>{"$repo", repos.back().name}, {"$arch", arch}}) {
+                for (size_t at; (at = url.find(var)) != std::string::npos;) url.replace(at, var.size(), val);
+            }
+            repos.back().servers.push_back(url);
+        }
+        repos.back().arch = arch;
+        servers.clear();
+    };
+
+    bool in_repo = false;
+    read_lines(conf_path, [&](const std::string& key, const std::string& val) {
+        if (key.size() > 2 && key.front() == '[' && key.back() == ']') {
+            finish();
+            std::string section = key.substr(1, key.size() - 2);
+            in_repo = section != "options";
+            if (in_repo) {
+                repos.emplace_back();
+                repos.back().name = section;
+            }
+        } else if (!in_repo && key == "Architecture") {
+            std::istringstream(val) >> arch;    // the first of possibly several
+        } else if (in_repo && key == "Server") {
+            servers.push_back(val);
+        } else if (in_repo && key == "Include") {
+            repos.back().includes.push_back(val);
+            read_lines(val, [&](const std::string& k, const std::string& v) {
+                if (k == "Server") servers.push_back(v);
+            });
+        }
+    });
+    finish();
+    return repos;
+}
+
+// Repo order from pacman.conf, so duplicate names resolve the way pacman -S does.
+std::vector<std::string> pacman_repo_order() {
+    std::vector<std::string> order;
+    for (const auto& repo : pacman_repos(g_config.pacman_conf)) order.push_back(repo.name);
+    return order;
+}
+
+// Binary index over the sync databases (<dbpath>/sync/*.db), cached under
+// ~/.cache/rinse and mmap'd on later runs. The cache is keyed on the mtime and
+// size of every .db file, so it rebuilds itself after a -Sy.
+//
+// Layout: header | repo table | entries sorted by name | string pool.
+// Lists (depends, provides) are stored as newline-joined strings.
+class SyncIndex {
+public:
+    SyncIndex() = default;
+    SyncIndex(const SyncIndex&) = delete;
+    SyncIndex& operator=(const SyncIndex&) = delete;
+
+    ~SyncIndex() {
+        if (mapped_) munmap(const_cast<char*>(data_), size_);
+    }
+
+    bool open(const std::string& sync_dir, const std::string& cache_path) {
+        std::vector<DbFile> dbs = list_dbs(sync_dir);
+        if (dbs.empty()) return false;
+
+        if (map_file(cache_path) && matches(sync_dir, dbs)) return true;
+        unmap();
+
+        std::vector<char> blob = build(sync_dir, dbs);
+        if (blob.empty()) return false;
+
+        std::error_code ec;
+        fs::create_directories(fs::path(cache_path).parent_path(), ec);
+        std::string tmp_path = cache_path + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            out.write(blob.data(), blob.size());
+        }
+        if (!ec && fs::file_size(tmp_path, ec) == blob.size() && !ec) {
+            fs::rename(tmp_path, cache_path, ec);
+            if (!ec && map_file(cache_path) && matches(sync_dir, dbs)) return true;
+            unmap();
+        }
+        fs::remove(tmp_path, ec);
+
+        // Cache dir not writable: serve this run from memory.
+        owned_ = std::move(blob);
+        data_ = owned_.data();
+        size_ = owned_.size();
+        return true;
+    }
+
+    size_t size() const { return data_ ? header()->entry_count : 0; }
+
+    std::string_view name_at(size_t i) const { return str(entries()[i].name); }
+    std::string_view version_at(size_t i) const { return str(entries()[i].version); }
+    std::string_view repo_at(size_t i) const { return str(repos()[entries()[i].repo].name); }
+
+    SyncPackage at(size_t i) const {
+        const Entry& e = entries()[i];
+        SyncPackage pkg;
+        pkg.repo = std::string(str(repos()[e.repo].name));
+        pkg.name = std::string(str(e.name));
+        pkg.version = std::string(str(e.version));
+        pkg.filename = std::string(str(e.filename));
+        pkg.build_date = e.build_date;
+        pkg.csize = e.csize;
+        pkg.isize = e.isize;
+        pkg.depends = split_list(str(e.depends));
+        pkg.provides = split_list(str(e.provides));
+        return pkg;
+    }
+
+    // Accepts "name" or "repo/name".
+    bool find(const std::string& query, SyncPackage* out = nullptr) const {
+        if (!data_) return false;
+
+        std::string_view name = query;
+        std::string_view repo;
+        size_t slash = query.find('/');
+        if (slash != std::string::npos) {
+            repo = name.substr(0, slash);
+            name = name.substr(slash + 1);
+        }
+
+        const Entry* begin = entries();
+        const Entry* end = begin + size();
+        const Entry* it = std::lower_bound(begin, end, name,
+                                           [this](const Entry& e, std::string_view n) { return str(e.name) < n; });
+        for (; it != end && str(it->name) == name; ++it) {
+            if (!repo.empty() && str(repos()[it->repo].name) != repo) continue;
+            if (out) *out = at(it - begin);
+            return true;
+        }
+        return false;
+    }
+
+    // First package whose PROVIDES names `name` (with or without "=version").
+    // A linear scan over the mapped strings, meant for the odd virtual
+    // dependency ("sh", "java-runtime") rather than bulk lookups.
+    bool find_provider(std::string_view name, SyncPackage* out = nullptr) const {
+        for (size_t i = 0; i < size(); i++) {
+            std::string_view list = str(entries()[i].provides);
+            while (!list.empty()) {
+                size_t nl = list.find('\n');
+                std::string_view item = list.substr(0, nl);
+                if (item.substr(0, item.find('=')) == name) {
+                    if (out) *out = at(i);
+                    return true;
+                }
+                if (nl == std::string_view::npos) break;
+                list.remove_prefix(nl + 1);
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'I', 'N', 'S', 'E', 'I', 'D', 'X'};
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    struct Ref {
+        uint32_t off;
+        uint32_t len;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t repo_count;
+        uint32_t entry_count;
+        uint32_t pad;
+        uint64_t strings_size;
+        Ref sync_dir;
+    };
+
+    struct Repo {
+        Ref name;
+        int64_t mtime;
+        uint64_t size;
+    };
+
+    struct Entry {
+        Ref name;
+        Ref version;
+        Ref filename;
+        Ref depends;
+        Ref provides;
+        uint32_t repo;
+        uint32_t pad;
+        int64_t build_date;
+        uint64_t csize;
+        uint64_t isize;
+    };
+
+    struct DbFile {
+        std::string repo;
+        std::string path;
+        int64_t mtime;
+        uint64_t size;
+    };
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> owned_;
+
+    const Header* header() const { return reinterpret_cast<const Header*>(data_); }
+    const Repo* repos() const { return reinterpret_cast<const Repo*>(data_ + sizeof(Header)); }
+    const Entry* entries() const {
+        return reinterpret_cast<const Entry*>(data_ + sizeof(Header) + header()->repo_count * sizeof(Repo));
+    }
+    const char* strings() const {
+        return reinterpret_cast<const char*>(entries() + header()->entry_count);
+    }
+    std::string_view str(Ref r) const { return std::string_view(strings() + r.off, r.len); }
+
+    static std::vector<std::string> split_list(std::string_view joined) {
+        std::vector<std::string> items;
+        while (!joined.empty()) {
+            size_t nl = joined.find('\n');
+            items.emplace_back(joined.substr(0, nl));
+            if (nl == std::string_view::npos) break;
+            joined.remove_prefix(nl + 1);
+        }
+        return items;
+    }
+
+    static std::vector<DbFile> list_dbs(const std::string& sync_dir) {
+        std::vector<DbFile> dbs;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(sync_dir, ec)) {
+            if (entry.path().extension() != ".db") continue;
+            struct stat st;
+            if (stat(entry.path().c_str(), &st) != 0) continue;
+            dbs.push_back({entry.path().stem().string(), entry.path().string(), (int64_t)st.st_mtime, (uint64_t)st.st_size});
+        }
+
+        std::vector<std::string> order = pacman_repo_order();
+        auto rank = [&](const std::string& repo) {
+            auto it = std::find(order.begin(), order.end(), repo);
+            return (size_t)(it - order.begin());
+        };
+        std::sort(dbs.begin(), dbs.end(), [&](const DbFile& a, const DbFile& b) {
+            size_t ra = rank(a.repo), rb = rank(b.repo);
+            return ra != rb ? ra < rb : a.repo < b.repo;
+        });
+        return dbs;
+    }
+
+    bool map_file(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) return false;
+
+        data_ = static_cast<const char*>(addr);
+        size_ = st.st_size;
+        mapped_ = true;
+
+        const Header* h = header();
+        size_t expected = sizeof(Header) + (size_t)h->repo_count * sizeof(Repo) +
+                          (size_t)h->entry_count * sizeof(Entry) + h->strings_size;
+        if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->version != FORMAT_VERSION || expected != size_) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (mapped_) munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+    }
+
+    bool matches(const std::string& sync_dir, const std::vector<DbFile>& dbs) const {
+        if (str(header()->sync_dir) != sync_dir || header()->repo_count != dbs.size()) return false;
+        for (size_t i = 0; i < dbs.size(); i++) {
+            const Repo& r = repos()[i];
+            if (str(r.name) != dbs[i].repo || r.mtime != dbs[i].mtime || r.size != dbs[i].size) return false;
+        }
+        return true;
+    }
+
+
+    static std::vector<char> build(const std::string& sync_dir, const std::vector<DbFile>& dbs) {
+        struct Record {
+            uint32_t repo;
+            std::string name, version, filename, depends, provides;
+            int64_t build_date = 0;
+            uint64_t csize = 0, isize = 0;
+        };
+        std::vector<Record> records;
+
+        for (uint32_t r = 0; r < dbs.size(); r++) {
+            // Every desc in the archive starts with %FILENAME%, which marks record boundaries.
+            std::string section;
+            bool in_repo = false;
+            exec_lines({check_command("bsdtar") ? "bsdtar" : "tar", "-xOf", dbs[r].path}, [&](const std::string& line) {
+                if (line.empty()) {
+                    section.clear();
+                    return;
+                }
+                if (line.size() > 2 && line.front() == '%' && line.back() == '%') {
+                    section = line;
+                    if (section == "%FILENAME%") {
+                        records.emplace_back();
+                        records.back().repo = r;
+                        in_repo = true;
+                    }
+                    return;
+                }
+                if (!in_repo) return;
+                Record& rec = records.back();
+                if (section == "%FILENAME%") rec.filename = line;
+                else if (section == "%NAME%") rec.name = line;
+                else if (section == "%VERSION%") rec.version = line;
+                else if (section == "%BUILDDATE%") rec.build_date = std::strtoll(line.c_str(), nullptr, 10);
+                else if (section == "%CSIZE%") rec.csize = std::strtoull(line.c_str(), nullptr, 10);
+                else if (section == "%ISIZE%") rec.isize = std::strtoull(line.c_str(), nullptr, 10);
+                else if (section == "%DEPENDS%") rec.depends += (rec.depends.empty() ? "" : "\n") + line;
+                else if (section == "%PROVIDES%") rec.provides += (rec.provides.empty() ? "" : "\n") + line;
+            });
+        }
+
+        records.erase(std::remove_if(records.begin(), records.end(),
+                                     [](const Record& rec) { return rec.name.empty(); }),
+                      records.end());
+        std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+            return a.name != b.name ? a.name < b.name : a.repo < b.repo;
+        });
+
+        std::string pool;
+        auto add = [&pool](const std::string& s) {
+            Ref ref{(uint32_t)pool.size(), (uint32_t)s.size()};
+            pool += s;
+            return ref;
+        };
+
+        Header h = {};
+        memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = FORMAT_VERSION;
+        h.repo_count = dbs.size();
+        h.entry_count = records.size();
+        h.sync_dir = add(sync_dir);
+
+        std::vector<Repo> repo_table;
+        for (const auto& db : dbs) {
+            repo_table.push_back({add(db.repo), db.mtime, db.size});
+        }
+
+        std::vector<Entry> entry_table;
+        entry_table.reserve(records.size());
+        for (const auto& rec : records) {
+            Entry e = {};
+            e.name = add(rec.name);
+            e.version = add(rec.version);
+            e.filename = add(rec.filename);
+            e.depends = add(rec.depends);
+            e.provides = add(rec.provides);
+            e.repo = rec.repo;
+            e.build_date = rec.build_date;
+            e.csize = rec.csize;
+            e.isize = rec.isize;
+            entry_table.push_back(e);
+        }
+        h.strings_size = pool.size();
+
+        std::vector<char> blob;
+        blob.reserve(sizeof(h) + repo_table.size() * sizeof(Repo) + entry_table.size() * sizeof(Entry) + pool.size());
+        auto append = [&blob](const void* p, size_t n) {
+            const char* c = static_cast<const char*>(p);
+            blob.insert(blob.end(), c, c + n);
+        };
+        append(&h, sizeof(h));
+        append(repo_table.data(), repo_table.size() * sizeof(Repo));
+        append(entry_table.data(), entry_table.size() * sizeof(Entry));
+        append(pool.data(), pool.size());
+        return blob;
+    }
+};
+
+std::unique_ptr<SyncIndex> g_sync_index;
+
+const SyncIndex& sync_index() {
+    if (!g_sync_index) {
+        TracePhase phase("sync index");
+        g_sync_index = std::make_unique<SyncIndex>();
+        g_sync_index->open(g_dbpath + "/sync", get_cache_dir() + "/sync.idx");
+    }
+    return *g_sync_index;
+}
+
+std::string get_package_date_pacman(const std::string& pkg) {
+    SyncPackage info;
+    if (!sync_index().find(sanitize_package(pkg), &info) || info.build_date == 0) return "";
+    return format_date(info.build_date);
+}
+
+// Which package owns which file, from the files lists in the local database
+// (<dbpath>/local/*/files), cached under ~/.cache/rinse and mmap'd like the
+// sync index. Paths are sorted and front-coded in blocks of BLOCK entries:
+// the first of a block is stored whole and the rest only as what differs
+// from the path before, so a lookup is a binary search over block heads and
+// a short scan. Every package is keyed on its files list's mtime and size,
+// and when some change, the others are carried over from the old index
+// instead of being read again.
+//
+// Layout: header | package table | block offsets | blocks | string pool.
+// An entry is varint shared prefix length, varint suffix length, the
+// suffix, varint package. Paths are as pacman stores them: relative to the
+// root, with a trailing '/' on directories.
+class FileIndex {
+public:
+    FileIndex() = default;
+    FileIndex(const FileIndex&) = delete;
+    FileIndex& operator=(const FileIndex&) = delete;
+
+    ~FileIndex() {
+        if (mapped_) munmap(const_cast<char*>(data_), size_);
+    }
+
+    bool open(const std::string& local_dir, const std::string& cache_path) {
+        std::vector<PackageDir> pkgs = list_packages(local_dir);
+        if (pkgs.empty()) return false;
+
+        if (map_file(cache_path) && matches(local_dir, pkgs)) return true;
+        std::vector<char> blob = build(local_dir, pkgs);
+        unmap();
+
+        std::error_code ec;
+        fs::create_directories(fs::path(cache_path).parent_path(), ec);
+        std::string tmp_path = cache_path + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            out.write(blob.data(), blob.size());
+        }
+        if (!ec && fs::file_size(tmp_path, ec) == blob.size() && !ec) {
+            fs::rename(tmp_path, cache_path, ec);
+            if (!ec && map_file(cache_path) && matches(local_dir, pkgs)) return true;
+            unmap();
+        }
+        fs::remove(tmp_path, ec);
+
+        // Cache dir not writable: serve this run from memory.
+        owned_ = std::move(blob);
+        data_ = owned_.data();
+        size_ = owned_.size();
+        return true;
+    }
+
+    size_t size() const { return data_ ? header()->entry_count : 0; }
+    size_t package_count() const { return data_ ? header()->package_count : 0; }
+    std::string_view package_name(uint32_t i) const { return str(packages()[i].name); }
+    std::string_view package_version(uint32_t i) const { return str(packages()[i].version); }
+
+    // A package's own files list, read directly: cheaper than decoding the
+    // whole index to pick out its entries.
+    std::vector<std::string> package_files(uint32_t i) const {
+        std::ifstream file(std::string(str(header()->local_dir)) + "/" + std::string(str(packages()[i].dir)) + "/files",
+                           std::ios::binary);
+        std::ostringstream content;
+        content << file.rdbuf();
+        std::vector<std::string> files;
+        for_each_listed(content.str(), [&](std::string_view path) { files.emplace_back(path); });
+        return files;
+    }
+
+    // Packages are sorted by name; -1 if none is installed under it.
+    long find_package(std::string_view name) const {
+        const Package* begin = packages();
+        const Package* end = begin + package_count();
+        const Package* it = std::lower_bound(begin, end, name,
+                                             [this](const Package& p, std::string_view n) { return str(p.name) < n; });
+        return it != end && str(it->name) == name ? it - begin : -1;
+    }
+
+    // Calls fn(path, package) for each entry starting with prefix, in path
+    // order, until fn returns false.
+    void scan(std::string_view prefix, const std::function<bool(std::string_view, uint32_t)>& fn) const {
+        if (size() == 0) return;
+        Cursor cursor(*this, first_block(prefix));
+        while (cursor.next()) {
+            std::string_view path = cursor.path;
+            if (path < prefix) continue;
+            if (path.compare(0, prefix.size(), prefix) != 0 || !fn(path, cursor.package)) return;
+        }
+    }
+
+    // Entries starting with prefix whose "/path" matches a glob pattern, in
+    // path order. fnmatch is most of the cost, so the blocks are split
+    // across threads.
+    std::vector<std::pair<std::string, uint32_t>> glob(std::string_view prefix, const std::string& pattern) const {
+        if (size() == 0) return {};
+        size_t lo = first_block(prefix), hi = lo + 1;
+        size_t end = header()->block_count;
+        while (hi < end) {    // first block past the prefix, by binary search
+            size_t mid = (hi + end) / 2;
+            std::string_view head = block_head(mid);
+            if (head > prefix && head.compare(0, prefix.size(), prefix) != 0) end = mid;
+            else hi = mid + 1;
+        }
+
+        const size_t chunk = 1024;
+        std::vector<std::vector<std::pair<std::string, uint32_t>>> found((end - lo + chunk - 1) / chunk);
+        parallel_for(found.size(), [&](size_t c) {
+            Cursor cursor(*this, lo + c * chunk);
+            std::string full = "/";
+            for (size_t n = std::min(chunk, end - lo - c * chunk) * BLOCK; n > 0 && cursor.next(); n--) {
+                if (cursor.path.compare(0, prefix.size(), prefix) != 0) continue;
+                full.resize(1);
+                full += cursor.path;
+                if (fnmatch(pattern.c_str(), full.c_str(), 0) == 0) found[c].emplace_back(cursor.path, cursor.package);
+            }
+        });
+        std::vector<std::pair<std::string, uint32_t>> matches;
+        for (auto& part : found) std::move(part.begin(), part.end(), std::back_inserter(matches));
+        return matches;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'I', 'N', 'S', 'E', 'F', 'I', 'L'};
+    static constexpr uint32_t FORMAT_VERSION = 1;
+    static constexpr size_t BLOCK = 16;
+
+    struct Ref {
+        uint32_t off;
+        uint32_t len;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t package_count;
+        uint64_t entry_count;
+        uint64_t block_count;
+        uint64_t blocks_size;
+        uint64_t strings_size;
+        Ref local_dir;
+    };
+
+    struct Package {
+        Ref name;
+        Ref version;
+        Ref dir;
+        int64_t mtime;     // of its files list
+        uint64_t size;
+    };
+
+    struct PackageDir {
+        std::string dir;
+        std::string name;
+        std::string version;
+        int64_t mtime;
+        uint64_t size;
+    };
+
+    // Walks entries in order from the start of a block.
+    struct Cursor {
+        const unsigned char* p;
+        uint64_t left;
+        std::string path;
+        uint32_t package = 0;
+
+        Cursor(const FileIndex& index, size_t block)
+            : p(reinterpret_cast<const unsigned char*>(index.blocks()) + index.block_offsets()[block]),
+              left(index.size() - block * BLOCK) {}
+
+        bool next() {
+            if (left == 0) return false;
+            left--;
+            size_t shared = read_varint(p);
+            size_t len = read_varint(p);
+            path.resize(shared);
+            path.append(reinterpret_cast<const char*>(p), len);
+            p += len;
+            package = read_varint(p);
+            return true;
+        }
+    };
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> owned_;
+
+    const Header* header() const { return reinterpret_cast<const Header*>(data_); }
+    const Package* packages() const { return reinterpret_cast<const Package*>(data_ + sizeof(Header)); }
+    const uint64_t* block_offsets() const {
+        return reinterpret_cast<const uint64_t*>(packages() + header()->package_count);
+    }
+    const char* blocks() const { return reinterpret_cast<const char*>(block_offsets() + header()->block_count); }
+    const char* strings() const { return blocks() + header()->blocks_size; }
+    std::string_view str(Ref r) const { return std::string_view(strings() + r.off, r.len); }
+
+    // The last block whose head sorts at or before key, where a scan for
+    // key has to start.
+    size_t first_block(std::string_view key) const {
+        size_t lo = 0, hi = header()->block_count;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (block_head(mid) <= key) lo = mid;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    std::string_view block_head(size_t block) const {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(blocks()) + block_offsets()[block];
+        read_varint(p);    // shared, always 0 here
+        size_t len = read_varint(p);
+        return std::string_view(reinterpret_cast<const char*>(p), len);
+    }
+
+    // Paths in the %FILES% section of a files list.
+    static void for_each_listed(std::string_view list, const std::function<void(std::string_view)>& fn) {
+        size_t start = list.find("%FILES%\n");
+        if (start == std::string_view::npos) return;
+        for (start += 8; start < list.size();) {
+            size_t end = std::min(list.find('\n', start), list.size());
+            if (end == start) break;    // the blank line closing the section
+            fn(list.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    static uint64_t read_varint(const unsigned char*& p) {
+        uint64_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            unsigned char byte = *p++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+    }
+
+    static void write_varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out += (char)(value | 0x80);
+            value >>= 7;
+        }
+        out += (char)value;
+    }
+
+    // Directory names are "<name>-<pkgver>-<pkgrel>".
+    static std::vector<PackageDir> list_packages(const std::string& local_dir) {
+        std::vector<PackageDir> pkgs;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(local_dir, ec)) {
+            std::string dir = entry.path().filename().string();
+            size_t rel = dir.rfind('-');
+            size_t ver = rel == std::string::npos || rel == 0 ? std::string::npos : dir.rfind('-', rel - 1);
+            struct stat st;
+            if (ver == std::string::npos || ver == 0 || stat((entry.path().string() + "/files").c_str(), &st) != 0) continue;
+            pkgs.push_back({dir, dir.substr(0, ver), dir.substr(ver + 1), (int64_t)st.st_mtime, (uint64_t)st.st_size});
+        }
+        std::sort(pkgs.begin(), pkgs.end(), [](const PackageDir& a, const PackageDir& b) {
+            return a.name != b.name ? a.name < b.name : a.dir < b.dir;
+        });
+        return pkgs;
+    }
+
+    bool map_file(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) return false;
+
+        data_ = static_cast<const char*>(addr);
+        size_ = st.st_size;
+        mapped_ = true;
+
+        const Header* h = header();
+        size_t expected = sizeof(Header) + (size_t)h->package_count * sizeof(Package) +
+                          h->block_count * sizeof(uint64_t) + h->blocks_size + h->strings_size;
+        if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->version != FORMAT_VERSION || expected != size_ ||
+            h->block_count != (h->entry_count + BLOCK - 1) / BLOCK) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (mapped_) munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+        owned_.clear();
+    }
+
+    bool matches(const std::string& local_dir, const std::vector<PackageDir>& pkgs) const {
+        if (str(header()->local_dir) != local_dir || header()->package_count != pkgs.size()) return false;
+        for (size_t i = 0; i < pkgs.size(); i++) {
+            const Package& p = packages()[i];
+            if (str(p.dir) != pkgs[i].dir || p.mtime != pkgs[i].mtime || p.size != pkgs[i].size) return false;
+        }
+        return true;
+    }
+
+    // Builds the index for pkgs. Packages unchanged since the index that is
+    // currently open keep their entries from it, merged with the paths read
+    // from the files lists of the rest.
+    std::vector<char> build(const std::string& local_dir, const std::vector<PackageDir>& pkgs) const {
+        std::vector<long> carried;    // old package -> new one, or -1
+        std::vector<char> reused(pkgs.size(), 0);
+        if (data_ && str(header()->local_dir) == local_dir) {
+            std::unordered_map<std::string_view, size_t> by_dir;
+            for (size_t i = 0; i < pkgs.size(); i++) by_dir[pkgs[i].dir] = i;
+            carried.assign(package_count(), -1);
+            for (size_t i = 0; i < package_count(); i++) {
+                const Package& p = packages()[i];
+                auto it = by_dir.find(str(p.dir));
+                if (it == by_dir.end() || p.mtime != pkgs[it->second].mtime || p.size != pkgs[it->second].size) continue;
+                carried[i] = it->second;
+                reused[it->second] = 1;
+            }
+        }
+
+        std::vector<std::string> lists(pkgs.size());
+        parallel_for(pkgs.size(), [&](size_t i) {
+            if (reused[i]) return;
+            std::ifstream file(local_dir + "/" + pkgs[i].dir + "/files", std::ios::binary);
+            std::ostringstream content;
+            content << file.rdbuf();
+            lists[i] = content.str();
+        });
+        std::vector<std::pair<std::string_view, uint32_t>> fresh;
+        for (uint32_t i = 0; i < pkgs.size(); i++) {
+            for_each_listed(lists[i], [&](std::string_view path) { fresh.emplace_back(path, i); });
+        }
+        std::sort(fresh.begin(), fresh.end());
+
+        std::string pool;
+        auto add = [&pool](std::string_view s) {
+            Ref ref{(uint32_t)pool.size(), (uint32_t)s.size()};
+            pool += s;
+            return ref;
+        };
+        Header h = {};
+        memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = FORMAT_VERSION;
+        h.package_count = pkgs.size();
+        h.local_dir = add(local_dir);
+        std::vector<Package> package_table;
+        for (const auto& pkg : pkgs) {
+            Package p = {};
+            p.name = add(pkg.name);
+            p.version = add(pkg.version);
+            p.dir = add(pkg.dir);
+            p.mtime = pkg.mtime;
+            p.size = pkg.size;
+            package_table.push_back(p);
+        }
+
+        std::vector<uint64_t> offsets;
+        std::string data;
+        std::string prev;
+        auto emit = [&](std::string_view path, uint32_t package) {
+            size_t shared = 0;
+            if (h.entry_count % BLOCK == 0) {
+                offsets.push_back(data.size());
+            } else {
+                size_t limit = std::min(prev.size(), path.size());
+                while (shared < limit && prev[shared] == path[shared]) shared++;
+            }
+            write_varint(data, shared);
+            write_varint(data, path.size() - shared);
+            data.append(path.substr(shared));
+            write_varint(data, package);
+            prev.assign(path);
+            h.entry_count++;
+        };
+
+        // Both streams are in (path, package) order; package ids keep their
+        // relative order from old to new, since both tables are by name.
+        auto next_fresh = fresh.begin();
+        if (!carried.empty() && size() > 0) {
+            Cursor cursor(*this, 0);
+            while (cursor.next()) {
+                if (carried[cursor.package] < 0) continue;
+                std::pair<std::string_view, uint32_t> old_entry(cursor.path, carried[cursor.package]);
+                for (; next_fresh != fresh.end() && *next_fresh < old_entry; ++next_fresh) emit(next_fresh->first, next_fresh->second);
+                emit(old_entry.first, old_entry.second);
+            }
+        }
+        for (; next_fresh != fresh.end(); ++next_fresh) emit(next_fresh->first, next_fresh->second);
+        h.block_count = offsets.size();
+        h.blocks_size = data.size();
+        h.strings_size = pool.size();
+
+        std::vector<char> blob;
+        blob.reserve(sizeof(h) + package_table.size() * sizeof(Package) + offsets.size() * sizeof(uint64_t) + data.size() + pool.size());
+        auto append = [&blob](const void* p, size_t n) {
+            const char* c = static_cast<const char*>(p);
+            blob.insert(blob.end(), c, c + n);
+        };
+        append(&h, sizeof(h));
+        append(package_table.data(), package_table.size() * sizeof(Package));
+        append(offsets.data(), offsets.size() * sizeof(uint64_t));
+        append(data.data(), data.size());
+        append(pool.data(), pool.size());
+        return blob;
+    }
+};
+
+std::unique_ptr<FileIndex> g_file_index;
+
+const FileIndex& file_index() {
+    if (!g_file_index) {
+        TracePhase phase("file index");
+        g_file_index = std::make_unique<FileIndex>();
+        if (!g_file_index->open(g_dbpath + "/local", get_cache_dir() + "/files.idx")) {
+            std::cerr << RED << "Could not read file lists in " << g_dbpath << "/local" << RESET << std::endl;
+        }
+    }
+    return *g_file_index;
+}
+
+struct AurPackage {
+    std::string name;
+    std::string package_base;
+    std::string version;
+    time_t last_modified = 0;
+    time_t out_of_date = 0;
+    std::vector<std::string> depends;
+    std::vector<std::string> make_depends;
+};
+
+// AUR RPC results for this run. Every name is looked up at most once; names
+// that weren't found are remembered in g_aur_queried as negative results.
+std::map<std::string, AurPackage> g_aur_info;
+std::set<std::string> g_aur_queried;
+std::recursive_mutex g_aur_mutex;
+
+const size_t AUR_BATCH_SIZE = 150;
+
+std::string aur_url_encode(const std::string& pkg) {
+    std::string encoded;
+    for (char c : pkg) {
+        if (c == '+') encoded += "%2B";
+        else if (c == '@') encoded += "%40";
+        else encoded += c;
+    }
+    return encoded;
+}
+
+AurPackage parse_aur_result(const JsonValue& result) {
+    AurPackage pkg;
+    pkg.name = result.get_string("Name");
+    pkg.package_base = result.get_string("PackageBase");
+    pkg.version = result.get_string("Version");
+    pkg.last_modified = result.get_int("LastModified");
+    pkg.out_of_date = result.get_int("OutOfDate");
+    pkg.depends = result.get_strings("Depends");
+    pkg.make_depends = result.get_strings("MakeDepends");
+    return pkg;
+}
+
+// One multiinfo request (arg[]=a&arg[]=b...) per AUR_BATCH_SIZE names.
+// Names from batches that got no valid answer are added to failed, since
+// their absence from the result says nothing.
+std::vector<AurPackage> aur_fetch(const std::vector<std::string>& names, std::set<std::string>* failed = nullptr) {
+    TracePhase phase("aur fetch");
+    std::vector<AurPackage> found;
+
+    for (size_t i = 0; i < names.size(); i += AUR_BATCH_SIZE) {
+        std::string url = g_config.aur_url + "/rpc/?v=5&type=info";
+        for (size_t j = i; j < std::min(names.size(), i + AUR_BATCH_SIZE); j++) {
+            url += "&arg[]=" + aur_url_encode(names[j]);
+        }
+
+        JsonValue response;
+        const JsonValue* results = nullptr;
+        if (parse_json(exec({"curl", "-sgf", "--connect-timeout", "10", "-m", "30", url}), response)) results = response.get("results");
+        if (!results || results->type != JsonValue::Array) {
+            if (failed) failed->insert(names.begin() + i, names.begin() + std::min(names.size(), i + AUR_BATCH_SIZE));
+            continue;
+        }
+        for (const auto& result : results->items) {
+            AurPackage pkg = parse_aur_result(result);
+            if (!pkg.name.empty()) found.push_back(std::move(pkg));
+        }
+    }
+
+    return found;
+}
+
+// On-disk AUR cache: one key=value file per package under ~/.cache/rinse/aur.
+// A "missing = true" entry records that the RPC didn't know the package.
+struct AurCacheEntry {
+    time_t fetched = 0;
+    bool missing = false;
+    AurPackage pkg;
+};
+
+time_t g_aur_cache_oldest = 0;
+
+std::string aur_cache_dir() {
+    return get_cache_dir() + "/aur";
+}
+
+std::string join(const std::vector<std::string>& items, const std::string& sep) {
+    std::string out;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (i > 0) out += sep;
+        out += items[i];
+    }
+    return out;
+}
+
+std::vector<std::string> split_words(const std::string& str) {
+    std::vector<std::string> words;
+    std::istringstream iss(str);
+    std::string word;
+    while (iss >> word) words.push_back(word);
+    return words;
+}
+
+std::string format_age(time_t seconds) {
+    if (seconds < 3600) return std::to_string(seconds / 60) + " minutes";
+    if (seconds < 86400) return std::to_string(seconds / 3600) + " hours";
+    return std::to_string(seconds / 86400) + " days";
+}
+
+bool aur_cache_read(const std::string& name, AurCacheEntry& entry) {
+    std::ifstream file(aur_cache_dir() + "/" + name);
+    if (!file) return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = trim(line.substr(0, eq));
+        std::string val = trim(line.substr(eq + 1));
+
+        if (key == "fetched") entry.fetched = std::strtoll(val.c_str(), nullptr, 10);
+        else if (key == "missing") entry.missing = (val == "true");
+        else if (key == "name") entry.pkg.name = val;
+        else if (key == "package_base") entry.pkg.package_base = val;
+        else if (key == "version") entry.pkg.version = val;
+        else if (key == "last_modified") entry.pkg.last_modified = std::strtoll(val.c_str(), nullptr, 10);
+        else if (key == "out_of_date") entry.pkg.out_of_date = std::strtoll(val.c_str(), nullptr, 10);
+        else if (key == "depends") entry.pkg.depends = split_words(val);
+        else if (key == "make_depends") entry.pkg.make_depends = split_words(val);
+    }
+
+    return entry.fetched != 0 && (entry.missing || entry.pkg.name == name);
+}
+
+void aur_cache_write(const std::string& name, const AurPackage* pkg) {
+    std::error_code ec;
+    fs::create_directories(aur_cache_dir(), ec);
+
+    std::string path = aur_cache_dir() + "/" + name;
+    std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file) return;
+        file << "fetched = " << time(nullptr) << "\n";
+        if (!pkg) {
+            file << "missing = true\n";
+        } else {
+            file << "name = " << pkg->name << "\n";
+            file << "package_base = " << pkg->package_base << "\n";
+            file << "version = " << pkg->version << "\n";
+            file << "last_modified = " << pkg->last_modified << "\n";
+            file << "out_of_date = " << pkg->out_of_date << "\n";
+            file << "depends = " << join(pkg->depends, " ") << "\n";
+            file << "make_depends = " << join(pkg->make_depends, " ") << "\n";
+        }
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) fs::remove(tmp_path, ec);
+}
+
+// Fetches names from the RPC and rewrites their cache entries. The RPC sends
+// no ETag/Last-Modified validators, so revalidation is one batched re-fetch.
+// Names whose request failed keep whatever entry they had, rather than
+// being cached as missing.
+std::map<std::string, AurPackage> aur_fetch_and_cache(const std::vector<std::string>& names) {
+    std::map<std::string, AurPackage> found;
+    std::set<std::string> failed;
+    for (auto& pkg : aur_fetch(names, &failed)) {
+        std::string name = pkg.name;
+        found[name] = std::move(pkg);
+    }
+
+    if (g_config.aur_cache_ttl > 0) {
+        for (const auto& name : names) {
+            if (failed.count(name)) continue;
+            auto it = found.find(name);
+            aur_cache_write(name, it == found.end() ? nullptr : &it->second);
+        }
+    }
+    return found;
+}
+
+// Stale entries are served immediately and refreshed by a separate
+// `rinse --refresh-aur` process, so the current run never waits on the
+// network for them. Being its own exec'd process, it holds none of this
+// one's descriptors (a pipe to the caller, a daemon client's socket).
+void aur_refresh_in_background(const std::vector<std::string>& names) {
+    std::error_code ec;
+    fs::path self = fs::read_symlink("/proc/self/exe", ec);
+    std::vector<std::string> cmd = {ec ? "rinse" : self.string(), "--refresh-aur"};
+    cmd.insert(cmd.end(), names.begin(), names.end());
+    exec_background(cmd);
+}
+
+void aur_prefetch(const std::vector<std::string>& pkgs) {
+    std::lock_guard<std::recursive_mutex> lock(g_aur_mutex);
+    std::vector<std::string> missing, stale;
+    time_t now = time(nullptr);
+    time_t ttl = (time_t)g_config.aur_cache_ttl * 60;
+    bool use_cache = g_offline || g_config.aur_cache_ttl > 0;
+
+    for (const auto& pkg : pkgs) {
+        std::string name = sanitize_package(pkg);
+        if (name.empty() || !g_aur_queried.insert(name).second) continue;
+
+        AurCacheEntry entry;
+        if (!use_cache || !aur_cache_read(name, entry)) {
+            missing.push_back(name);
+            continue;
+        }
+
+        if (!entry.missing) g_aur_info[name] = entry.pkg;
+        if (g_offline) {
+            if (g_aur_cache_oldest == 0 || entry.fetched < g_aur_cache_oldest) g_aur_cache_oldest = entry.fetched;
+        } else if (now - entry.fetched >= ttl) {
+            stale.push_back(name);
+        }
+    }
+
+    if (g_offline) return;
+
+    if (!missing.empty()) {
+        for (auto& found : aur_fetch_and_cache(missing)) {
+            g_aur_info[found.first] = std::move(found.second);
+        }
+    }
+    if (!stale.empty()) {
+        aur_refresh_in_background(stale);
+    }
+}
+
+void report_aur_cache_age() {
+    if (!g_offline || g_aur_cache_oldest == 0) return;
+    std::cout << YELLOW << "Offline: AUR information is from cache (oldest entry is "
+              << format_age(time(nullptr) - g_aur_cache_oldest) << " old)" << RESET << std::endl;
+}
+
+const AurPackage* aur_lookup(const std::string& pkg) {
+    std::string name = sanitize_package(pkg);
+    std::lock_guard<std::recursive_mutex> lock(g_aur_mutex);
+    aur_prefetch({name});
+    auto it = g_aur_info.find(name);
+    return it == g_aur_info.end() ? nullptr : &it->second;
+}
+
+std::string get_package_date_aur(const std::string& pkg) {
+    const AurPackage* info = aur_lookup(pkg);
+    if (!info || info->last_modified == 0) return "";
+    return format_date(info->last_modified);
+}
+
+bool package_in_aur(const std::string& pkg) {
+    return aur_lookup(pkg) != nullptr;
+}
+
+bool is_installed(const std::string& pkg) {
+    return local_db().find(sanitize_package(pkg)) != nullptr;
+}
+
+struct Upgrade {
+    std::string name;
+    std::string repo;
+    std::string from;
+    std::string to;
+};
+
+// What pacman -Qu reports: installed packages with a newer version in the
+// sync DBs. Both tables are sorted by name, so this is one merge join,
+// done once per run (or per daemon refresh) rather than per package.
+std::unique_ptr<std::vector<Upgrade>> g_upgradable;
+
+const std::vector<Upgrade>& upgradable() {
+    if (!g_upgradable) {
+        const auto& local = local_db().packages();
+        const SyncIndex& sync = sync_index();
+        TracePhase phase("upgradable");
+        g_upgradable = std::make_unique<std::vector<Upgrade>>();
+        size_t j = 0;
+        for (const auto& pkg : local) {
+            while (j < sync.size() && sync.name_at(j) < pkg.name) j++;
+            if (j == sync.size()) break;
+            // The first entry of a name is the one from the highest-priority repo.
+            if (sync.name_at(j) != pkg.name) continue;
+            if (vercmp(sync.version_at(j), pkg.version) > 0) {
+                g_upgradable->push_back({pkg.name, std::string(sync.repo_at(j)), pkg.version, std::string(sync.version_at(j))});
+            }
+        }
+    }
+    return *g_upgradable;
+}
+
+bool is_outdated(const std::string& pkg) {
+    std::string name = sanitize_package(pkg);
+    const auto& upgrades = upgradable();
+    auto it = std::lower_bound(upgrades.begin(), upgrades.end(), name,
+                               [](const Upgrade& u, const std::string& n) { return u.name < n; });
+    return it != upgrades.end() && it->name == name;
+}
+
+bool package_in_pacman(const std::string& pkg) {
+    return sync_index().find(sanitize_package(pkg));
+}
+
+struct NameMatch {
+    std::string name;
+    int distance = 0;
+    bool installed = false;
+};
+
+// Levenshtein distance between a pattern of up to 64 bytes and a text, using
+// Myers' bit-parallel algorithm (Hyyrö's formulation): one 64-bit word holds
+// a whole DP column, so each text byte costs a handful of word operations.
+class EditDistance {
+public:
+    explicit EditDistance(std::string_view pattern) : len_(pattern.size()) {
+        memset(peq_, 0, sizeof(peq_));
+        for (size_t i = 0; i < len_ && i < 64; i++) {
+            peq_[(unsigned char)pattern[i]] |= uint64_t(1) << i;
+        }
+        pattern_ = pattern;
+    }
+
+    int operator()(std::string_view text) const {
+        if (len_ == 0) return (int)text.size();
+        if (len_ > 64) return slow(text);
+
+        uint64_t last = uint64_t(1) << (len_ - 1);
+        uint64_t pv = ~uint64_t(0);
+        uint64_t mv = 0;
+        int score = (int)len_;
+        for (unsigned char c : text) {
+            uint64_t eq = peq_[c];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last) score++;
+            else if (mh & last) score--;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
+
+private:
+    uint64_t peq_[256];
+    size_t len_;
+    std::string_view pattern_;
+
+    int slow(std::string_view text) const {
+        std::vector<int> row(pattern_.size() + 1);
+        for (size_t i = 0; i < row.size(); i++) row[i] = (int)i;
+        for (size_t j = 1; j <= text.size(); j++) {
+            int diag = row[0];
+            row[0] = (int)j;
+            for (size_t i = 1; i <= pattern_.size(); i++) {
+                int up = row[i];
+                row[i] = std::min({row[i] + 1, row[i - 1] + 1, diag + (pattern_[i - 1] == text[j - 1] ? 0 : 1)});
+                diag = up;
+            }
+        }
+        return row.back();
+    }
+};
+
+// Trigram index over every installed and sync-repo package name, used for
+// "did you mean" suggestions. Names are lowercased once into a string pool;
+// postings are stored CSR-style (sorted trigram keys, offsets, name ids).
+// A query counts shared trigrams per name, keeps the names that could be
+// within the edit-distance budget (q-gram lemma), and re-ranks those with
+// EditDistance.
+class NameIndex {
+public:
+    void build(const LocalDB& local, const SyncIndex& sync) {
+        names_.clear();
+        pool_.clear();
+        offsets_ = {0};
+        installed_.clear();
+
+        // Both sources are sorted by name, so a merge drops duplicates.
+        const auto& pkgs = local.packages();
+        size_t li = 0, si = 0;
+        while (li < pkgs.size() || si < sync.size()) {
+            std::string_view sync_name = si < sync.size() ? sync.name_at(si) : std::string_view();
+            if (li < pkgs.size() && (si >= sync.size() || pkgs[li].name <= sync_name)) {
+                if (si < sync.size() && pkgs[li].name == sync_name) si++;
+                add(pkgs[li++].name, true);
+            } else {
+                if (names_.empty() || names_.back() != sync_name) add(sync_name, false);
+                si++;
+            }
+        }
+
+        std::vector<std::pair<uint32_t, uint32_t>> grams;
+        for (uint32_t id = 0; id < names_.size(); id++) {
+            for_each_trigram(lowered(id), [&](uint32_t key) { grams.push_back({key, id}); });
+        }
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+        keys_.clear();
+        starts_.clear();
+        postings_.clear();
+        postings_.reserve(grams.size());
+        for (const auto& g : grams) {
+            if (keys_.empty() || keys_.back() != g.first) {
+                keys_.push_back(g.first);
+                starts_.push_back(postings_.size());
+            }
+            postings_.push_back(g.second);
+        }
+        starts_.push_back(postings_.size());
+    }
+
+    size_t size() const { return names_.size(); }
+
+    // Up to `limit` names closest to `query`, best first. Names that contain
+    // the query are accepted even past the distance budget, so "fox" still
+    // finds "firefox".
+    std::vector<NameMatch> suggest(const std::string& query, size_t limit, bool installed_only = false) const {
+        std::vector<NameMatch> result;
+        std::string q = to_lower(query);
+        if (q.empty() || names_.empty()) return result;
+
+        int budget = std::clamp((int)q.size() / 3, 1, 3);
+        std::vector<uint32_t> query_grams;
+        for_each_trigram(q, [&](uint32_t key) { query_grams.push_back(key); });
+        std::sort(query_grams.begin(), query_grams.end());
+        query_grams.erase(std::unique(query_grams.begin(), query_grams.end()), query_grams.end());
+
+        // Each edit touches at most three trigrams.
+        int needed = std::max(1, (int)query_grams.size() - 3 * budget);
+
+        std::vector<uint16_t> shared(names_.size(), 0);
+        std::vector<uint32_t> candidates;
+        for (uint32_t key : query_grams) {
+            auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+            if (it == keys_.end() || *it != key) continue;
+            size_t k = it - keys_.begin();
+            for (size_t p = starts_[k]; p < starts_[k + 1]; p++) {
+                uint32_t id = postings_[p];
+                if (++shared[id] == needed) candidates.push_back(id);
+            }
+        }
+
+        EditDistance distance(q);
+        std::vector<std::pair<uint32_t, int>> scored;
+        for (uint32_t id : candidates) {
+            if (installed_only && !installed_[id]) continue;
+            std::string_view name = lowered(id);
+            int d = std::abs((int)name.size() - (int)q.size()) <= budget ? distance(name) : budget + 1;
+            bool contains = name.find(q) != std::string_view::npos;
+            if (d > budget && !contains) continue;
+            scored.push_back({id, d});
+        }
+
+        // Within budget first, then containment matches; ties go to the
+        // installed name, then the shorter one.
+        auto rank = [&](const std::pair<uint32_t, int>& a, const std::pair<uint32_t, int>& b) {
+            bool a_close = a.second <= budget, b_close = b.second <= budget;
+            if (a_close != b_close) return a_close;
+            int ad = a_close ? a.second : (int)lowered(a.first).size();
+            int bd = b_close ? b.second : (int)lowered(b.first).size();
+            if (ad != bd) return ad < bd;
+            if (installed_[a.first] != installed_[b.first]) return (bool)installed_[a.first];
+            return names_[a.first] < names_[b.first];
+        };
+        size_t keep = std::min(limit, scored.size());
+        std::partial_sort(scored.begin(), scored.begin() + keep, scored.end(), rank);
+
+        for (size_t i = 0; i < keep; i++) {
+            result.push_back({names_[scored[i].first], scored[i].second, (bool)installed_[scored[i].first]});
+        }
+        return result;
+    }
+
+private:
+    std::vector<std::string> names_;
+    std::string pool_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint8_t> installed_;
+    std::vector<uint32_t> keys_;
+    std::vector<uint32_t> starts_;
+    std::vector<uint32_t> postings_;
+
+    void add(std::string_view name, bool installed) {
+        names_.emplace_back(name);
+        pool_ += to_lower(std::string(name));
+        offsets_.push_back(pool_.size());
+        installed_.push_back(installed);
+    }
+
+    std::string_view lowered(uint32_t id) const {
+        return std::string_view(pool_).substr(offsets_[id], offsets_[id + 1] - offsets_[id]);
+    }
+
+    // Trigrams of "  name ", so short names and prefixes still get grams.
+    template <typename Fn>
+    static void for_each_trigram(std::string_view s, Fn fn) {
+        uint32_t window = ((uint32_t)' ' << 8) | ' ';
+        for (size_t i = 0; i <= s.size(); i++) {
+            unsigned char c = i < s.size() ? (unsigned char)s[i] : ' ';
+            window = ((window << 8) | c) & 0xFFFFFF;
+            fn(window);
+        }
+    }
+};
+
+std::unique_ptr<NameIndex> g_name_index;
+
+const NameIndex& name_index() {
+    if (!g_name_index) {
+        TracePhase phase("name index");
+        g_name_index = std::make_unique<NameIndex>();
+        g_name_index->build(local_db(), sync_index());
+    }
+    return *g_name_index;
+}
+
+// Closest installed package name, or "" when nothing is close enough.
+std::string fuzzy_search_package(const std::string& query) {
+    auto matches = name_index().suggest(sanitize_package(query), 1, true);
+    return matches.empty() ? "" : matches[0].name;
+}
+
+struct FlatpakRemoteApp {
+    std::string id;
+    std::string name;
+    std::string summary;
+    std::string remote;
+};
+
+std::string xml_unescape(const std::string& text) {
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '&') {
+            out += text[i];
+            continue;
+        }
+        size_t semi = text.find(';', i);
+        if (semi == std::string::npos) {
+            out += text[i];
+            continue;
+        }
+        std::string entity = text.substr(i + 1, semi - i - 1);
+        if (entity == "amp") out += '&';
+        else if (entity == "lt") out += '<';
+        else if (entity == "gt") out += '>';
+        else if (entity == "quot") out += '"';
+        else if (entity == "apos") out += '\'';
+        else out += text.substr(i, semi - i + 1);
+        i = semi;
+    }
+    return out;
+}
+
+// Searchable copy of the appstream catalogs flatpak already keeps on disk
+// (<system dir>/appstream/<remote>/<arch>/active/appstream.xml[.gz]).
+// Parsed catalogs are cached in ~/.cache/rinse/appstream.idx, keyed on the
+// mtime of every source file.
+class AppstreamCatalog {
+public:
+    void load(const std::string& system_dir, const std::string& cache_path) {
+        apps_.clear();
+        std::vector<Source> sources = find_sources(system_dir);
+        if (sources.empty()) return;
+
+        if (read_cache(cache_path, sources)) return;
+
+        for (const auto& src : sources) {
+            std::string xml = src.path.size() > 3 && src.path.compare(src.path.size() - 3, 3, ".gz") == 0
+                                  ? exec({"gzip", "-dc", src.path})
+                                  : read_file(src.path);
+            parse(xml, src.remote);
+        }
+        write_cache(cache_path, sources);
+    }
+
+    // Ranked search over app ID, name and summary, best match first.
+    std::vector<const FlatpakRemoteApp*> search(const std::string& query, size_t limit) const {
+        std::string needle = to_lower(query);
+        std::vector<std::pair<int, const FlatpakRemoteApp*>> scored;
+        if (needle.empty()) return {};
+
+        for (const auto& app : apps_) {
+            int score = rank(app, needle);
+            if (score > 0) scored.push_back({score, &app.app});
+        }
+
+        std::sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) {
+            if (a.first != b.first) return a.first > b.first;
+            if (a.second->name.size() != b.second->name.size()) return a.second->name.size() < b.second->name.size();
+            return a.second->id < b.second->id;
+        });
+
+        std::vector<const FlatpakRemoteApp*> results;
+        for (size_t i = 0; i < scored.size() && i < limit; i++) results.push_back(scored[i].second);
+        return results;
+    }
+
+    size_t size() const { return apps_.size(); }
+
+private:
+    static constexpr const char* CACHE_HEADER = "rinse-appstream 1";
+
+    struct Entry {
+        FlatpakRemoteApp app;
+        std::string lower_id;
+        std::string lower_leaf;
+        std::string lower_name;
+        std::string lower_summary;
+    };
+
+    struct Source {
+        std::string remote;
+        std::string path;
+        int64_t mtime;
+    };
+
+    std::vector<Entry> apps_;
+
+    static int rank(const Entry& e, const std::string& needle) {
+        if (e.lower_id == needle || e.lower_leaf == needle) return 100;
+        if (e.lower_name == needle) return 90;
+        if (e.lower_name.compare(0, needle.size(), needle) == 0) return 70;
+        if (e.lower_leaf.compare(0, needle.size(), needle) == 0) return 60;
+        if (e.lower_name.find(needle) != std::string::npos) return 50;
+        if (e.lower_id.find(needle) != std::string::npos) return 40;
+        if (e.lower_summary.find(needle) != std::string::npos) return 20;
+        return 0;
+    }
+
+    void add(FlatpakRemoteApp app) {
+        Entry e;
+        e.lower_id = to_lower(app.id);
+        e.lower_leaf = e.lower_id.substr(e.lower_id.rfind('.') + 1);
+        e.lower_name = to_lower(app.name);
+        e.lower_summary = to_lower(app.summary);
+        e.app = std::move(app);
+        apps_.push_back(std::move(e));
+    }
+
+    static std::string read_file(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        std::ostringstream ss;
+        ss << file.rdbuf();
+        return ss.str();
+    }
+
+    static std::vector<Source> find_sources(const std::string& system_dir) {
+        std::vector<Source> sources;
+        std::error_code ec;
+        for (const auto& remote : fs::directory_iterator(system_dir + "/appstream", ec)) {
+            for (const auto& arch : fs::directory_iterator(remote.path(), ec)) {
+                for (const char* name : {"appstream.xml.gz", "appstream.xml"}) {
+                    fs::path path = arch.path() / "active" / name;
+                    struct stat st;
+                    if (stat(path.c_str(), &st) != 0) continue;
+                    sources.push_back({remote.path().filename().string(), path.string(), (int64_t)st.st_mtime});
+                    break;
+                }
+            }
+        }
+        std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.path < b.path; });
+        return sources;
+    }
+
+    // Text of the first <tag> child without an xml:lang attribute (the untranslated one).
+    static std::string element_text(const std::string& xml, size_t begin, size_t end, const std::string& tag) {
+        std::string open = "<" + tag;
+        size_t pos = begin;
+        while ((pos = xml.find(open, pos)) != std::string::npos && pos < end) {
+            char next = xml[pos + open.size()];
+            size_t close = xml.find('>', pos);
+            if ((next != '>' && next != ' ') || close == std::string::npos || close > end) {
+                pos += open.size();
+                continue;
+            }
+            std::string attrs = xml.substr(pos + open.size(), close - pos - open.size());
+            size_t text_end = xml.find("</" + tag + ">", close);
+            if (attrs.find("xml:lang") == std::string::npos && text_end != std::string::npos && text_end < end) {
+                return trim(xml_unescape(xml.substr(close + 1, text_end - close - 1)));
+            }
+            pos = close;
+        }
+        return "";
+    }
+
+    void parse(const std::string& xml, const std::string& remote) {
+        size_t pos = 0;
+        while ((pos = xml.find("<component", pos)) != std::string::npos) {
+            size_t end = xml.find("</component>", pos);
+            if (end == std::string::npos) break;
+
+            FlatpakRemoteApp app;
+            app.id = element_text(xml, pos, end, "id");
+            app.name = element_text(xml, pos, end, "name");
+            app.summary = element_text(xml, pos, end, "summary");
+            app.remote = remote;
+            // Older catalogs suffix IDs with .desktop
+            if (app.id.size() > 8 && app.id.compare(app.id.size() - 8, 8, ".desktop") == 0) {
+                app.id.resize(app.id.size() - 8);
+            }
+            if (!app.id.empty()) add(std::move(app));
+            pos = end;
+        }
+    }
+
+    static std::string strip_tabs(std::string str) {
+        std::replace(str.begin(), str.end(), '\t', ' ');
+        std::replace(str.begin(), str.end(), '\n', ' ');
+        return str;
+    }
+
+    void write_cache(const std::string& cache_path, const std::vector<Source>& sources) const {
+        std::error_code ec;
+        fs::create_directories(fs::path(cache_path).parent_path(), ec);
+        std::string tmp_path = cache_path + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(tmp_path, std::ios::trunc);
+            if (!out) return;
+            out << CACHE_HEADER << "\n" << sources.size() << "\n";
+            for (const auto& src : sources) out << src.remote << "\t" << src.path << "\t" << src.mtime << "\n";
+            for (const auto& e : apps_) {
+                out << strip_tabs(e.app.id) << "\t" << strip_tabs(e.app.name) << "\t"
+                    << strip_tabs(e.app.summary) << "\t" << e.app.remote << "\n";
+            }
+        }
+        fs::rename(tmp_path, cache_path, ec);
+        if (ec) fs::remove(tmp_path, ec);
+    }
+
+    bool read_cache(const std::string& cache_path, const std::vector<Source>& sources) {
+        std::ifstream in(cache_path);
+        std::string line;
+        if (!std::getline(in, line) || line != CACHE_HEADER) return false;
+        if (!std::getline(in, line) || std::strtoul(line.c_str(), nullptr, 10) != sources.size()) return false;
+
+        for (const auto& src : sources) {
+            if (!std::getline(in, line)) return false;
+            if (line != src.remote + "\t" + src.path + "\t" + std::to_string(src.mtime)) return false;
+        }
+
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields;
+            size_t start = 0, tab;
+            while ((tab = line.find('\t', start)) != std::string::npos) {
+                fields.push_back(line.substr(start, tab - start));
+                start = tab + 1;
+            }
+            fields.push_back(line.substr(start));
+            if (fields.size() != 4) continue;
+            add({fields[0], fields[1], fields[2], fields[3]});
+        }
+        return true;
+    }
+};
+
+std::unique_ptr<AppstreamCatalog> g_appstream;
+
+const AppstreamCatalog& appstream_catalog() {
+    if (!g_appstream) {
+        TracePhase phase("appstream");
+        const char* system_dir = getenv("FLATPAK_SYSTEM_DIR");
+        g_appstream = std::make_unique<AppstreamCatalog>();
+        g_appstream->load(system_dir && *system_dir ? system_dir : "/var/lib/flatpak", get_cache_dir() + "/appstream.idx");
+    }
+    return *g_appstream;
+}
+
+// One catalog search per query per run, shared by every flatpak decision.
+std::vector<FlatpakRemoteApp> flatpak_search(const std::string& pkg) {
+    static std::map<std::string, std::vector<FlatpakRemoteApp>> results;
+    static std::mutex results_mutex;
+
+    std::string query = sanitize_package(pkg);
+    std::lock_guard<std::mutex> lock(results_mutex);
+    auto it = results.find(query);
+    if (it != results.end()) return it->second;
+
+    std::vector<FlatpakRemoteApp> found;
+    for (const auto* app : appstream_catalog().search(query, 5)) found.push_back(*app);
+    results[query] = found;
+    return found;
+}
+
+bool package_in_flatpak(const std::string& pkg) {
+    return !flatpak_search(pkg).empty();
+}
+
+std::string search_flatpak(const std::string& pkg) {
+    std::string result;
+    for (const auto& app : flatpak_search(pkg)) {
+        result += app.name + "\t" + app.summary + "\t" + app.id + "\t" + app.remote + "\n";
+    }
+    return result;
+}
+
+std::string get_flatpak_package_id(const std::string& pkg) {
+    auto found = flatpak_search(pkg);
+    return found.empty() ? "" : sanitize_package(found[0].id);
+}
+
+bool confirm(const std::string& prompt, bool default_yes = true) {
+    if (g_auto_confirm) return true;
+    TracePhase phase("confirm");
 
     bool has_suffix = prompt.find("[Y/n]") != std::string::npos ||
                       prompt.find("[y/N]") != std::string::npos;
 
-    if (has_suffix) {
-        std::cout << prompt << " " << std::flush;
-    } else {
-        std::string suffix = default_yes ? " [Y/n] " : " [y/N] ";
-        std::cout << prompt << suffix << std::flush;
+    if (has_suffix) {
+        std::cout << prompt << " " << std::flush;
+    } else {
+        std::string suffix = default_yes ? " [Y/n] " : " [y/N] ";
+        std::cout << prompt << suffix << std::flush;
+    }
+
+    std::string response;
+    std::getline(std::cin, response);
+    response = trim(response);
+
+    if (response == "yes") {
+        g_auto_confirm = true;
+        return true;
+    }
+
+    if (response.empty()) return default_yes;
+    return (response[0] == 'y' || response[0] == 'Y');
+}
+
+int get_terminal_width() {
+    struct winsize w = {};
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    int width = w.ws_col > 0 ? w.ws_col : 80;
+    return std::min(width, 120); // Cap at 120 chars
+}
+
+std::string render_progress_bar(int percent, bool failed, int bar_width) {
+    if (bar_width < 20) bar_width = 20;
+
+    std::string center_text = failed ? "FAILED" : std::to_string(percent) + "%";
+    int filled = failed ? bar_width : (percent * bar_width) / 100;
+
+    int center_pos = bar_width / 2 - center_text.length() / 2;
+
+    std::string out = "[";
+
+    for (int i = 0; i < bar_width; i++) {
+        if (i >= center_pos && i < center_pos + (int)center_text.length()) {
+            out += std::string(failed ? RED : RESET) + BOLD + center_text[i - center_pos] + RESET;
+        } else if (i < filled) {
+            out += std::string(failed ? RED : GREEN) + "=";
+        } else {
+            out += std::string(RED) + "-";
+        }
+    }
+
+    return out + RESET + "]";
+}
+
+void draw_progress_bar(int percent, bool failed = false, const std::string& status = "") {
+    int width = get_terminal_width();
+    int bar_width = width - 10 - (status.empty() ? 0 : (int)status.size() + 1);
+
+    std::cout << "\r" << render_progress_bar(percent, failed, bar_width);
+    if (!status.empty()) std::cout << " " << status;
+    std::cout << "\033[K" << std::flush;
+}
+
+std::string format_bytes(double bytes) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+    return buf;
+}
+
+double parse_size(double value, const std::string& unit) {
+    std::string u = to_lower(unit);
+    if (u[0] == 'k') return value * 1024;
+    if (u[0] == 'm') return value * 1024 * 1024;
+    if (u[0] == 'g') return value * 1024 * 1024 * 1024;
+    return value;
+}
+
+// Turns pacman/yay/flatpak output into progress. Counters like "(3/12)" or
+// flatpak's "Installing 2/5" drive the bar; each new counter run (checking
+// keys, downloading, installing, hooks...) is a new phase. ETA comes from
+// the step rate of the current phase, throughput from rates printed by the
+// tool or, for pacman, from "Total Download Size" spread over the
+// download steps.
+class ProgressTracker {
+public:
+    // Returns true if anything visible changed.
+    bool feed(const std::string& line) {
+        // Output comes from other programs: counters are capped at 9 digits
+        // so stoi can't overflow, and sizes go through strtod, which doesn't
+        // throw on what it can't represent.
+        static const std::regex counter_re("\\(\\s*(\\d{1,9})/(\\d{1,9})\\)\\s*(.*)");
+        static const std::regex flatpak_re("^\\s*(Installing|Updating|Uninstalling)\\s+(\\d{1,9})/(\\d{1,9})");
+        static const std::regex percent_re("(\\d{1,3})%");
+        static const std::regex rate_re("(\\d+(?:\\.\\d+)?)\\s*([KMG]i?B|B)/s");
+        static const std::regex total_re("Total Download Size:\\s*(\\d+(?:\\.\\d+)?)\\s*([KMG]i?B|B)");
+
+        std::smatch m;
+        bool changed = false;
+
+        if (std::regex_search(line, m, total_re)) {
+            download_bytes_ = parse_size(std::strtod(m[1].str().c_str(), nullptr), m[2]);
+        }
+
+        int step = 0, total = 0;
+        std::string label;
+        if (std::regex_search(line, m, counter_re)) {
+            step = std::stoi(m[1]);
+            total = std::stoi(m[2]);
+            label = trim(m[3]);
+        } else if (std::regex_search(line, m, flatpak_re)) {
+            step = std::stoi(m[2]);
+            total = std::stoi(m[3]);
+            label = m[1];
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (total > 0) {
+            if (total != total_ || step < step_) {
+                phase_start_ = now;
+                rate_.clear();
+            }
+            if (step != step_ || total != total_) changed = true;
+            step_ = step;
+            total_ = total;
+            sub_percent_ = 0;
+            downloading_ = label.find("download") != std::string::npos;
+            if (!label.empty()) label_ = label.substr(0, label.find(' ', 24));
+        }
+
+        if (std::regex_search(line, m, percent_re)) {
+            int pct = std::min(100, std::stoi(m[1]));
+            if (pct != sub_percent_) changed = true;
+            sub_percent_ = pct;
+        }
+
+        if (std::regex_search(line, m, rate_re)) {
+            rate_ = format_bytes(parse_size(std::strtod(m[1].str().c_str(), nullptr), m[2])) + "/s";
+            changed = true;
+        } else if (downloading_ && download_bytes_ > 0 && total_ > 0) {
+            double secs = std::chrono::duration<double>(now - phase_start_).count();
+            if (secs > 0.5) rate_ = format_bytes(download_bytes_ * step_ / total_ / secs) + "/s";
+        }
+
+        return changed;
+    }
+
+    int percent() const {
+        if (total_ <= 0) return 0;
+        double done = (step_ - 1 + sub_percent_ / 100.0) / total_;
+        if (sub_percent_ == 0) done = (double)step_ / total_;
+        return std::max(0, std::min(99, (int)(done * 100)));
+    }
+
+    std::string status(std::chrono::steady_clock::time_point start) const {
+        auto now = std::chrono::steady_clock::now();
+        std::string out;
+        if (total_ > 0) out = std::to_string(step_) + "/" + std::to_string(total_) + " " + label_;
+        if (!rate_.empty()) out += "  " + rate_;
+
+        if (total_ > 0 && step_ > 0 && step_ < total_) {
+            double secs = std::chrono::duration<double>(now - phase_start_).count();
+            int eta = (int)(secs / step_ * (total_ - step_));
+            out += "  ETA " + std::to_string(eta / 60) + ":" + (eta % 60 < 10 ? "0" : "") + std::to_string(eta % 60);
+        } else {
+            int secs = (int)std::chrono::duration<double>(now - start).count();
+            out += (out.empty() ? "" : "  ") + std::to_string(secs) + "s";
+        }
+        return out;
+    }
+
+private:
+    int step_ = 0;
+    int total_ = 0;
+    int sub_percent_ = 0;
+    bool downloading_ = false;
+    double download_bytes_ = 0;
+    std::string label_;
+    std::string rate_;
+    std::chrono::steady_clock::time_point phase_start_ = std::chrono::steady_clock::now();
+};
+
+void save_failure_log(const std::string& log, const std::string& path) {
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    std::ofstream out(path, std::ios::trunc);
+    out << log;
+}
+
+// Runs cmd behind a progress bar driven by the command's own output. The
+// output is kept, and shown (and saved) if the command fails.
+bool show_progress(const std::vector<std::string>& cmd, const std::string& action = "Processing", const ExecOptions& opts = {}) {
+    if (g_dry_run) {
+        std::cout << YELLOW << "[DRY RUN] Would execute: " << RESET << join_command(cmd) << "\n";
+        return true;
+    }
+
+    ExecOptions visible = opts;
+    visible.show_output = true;
+
+    if (g_full_log) {
+        int status = exec_status(cmd, visible);
+        if (status != 0) {
+            std::cout << RED << "✗ Operation failed" << RESET << std::endl;
+        }
+        return status == 0;
+    }
+
+    // Pre-authenticate sudo to avoid password prompt during progress bar
+    if (!cmd.empty() && cmd[0] == "sudo") {
+        exec_status({"sudo", "-v"}, visible);
+    }
+
+    ProgressTracker tracker;
+    std::string log;
+    auto start = std::chrono::steady_clock::now();
+    std::string last_status;
+    int last_percent = -1;
+
+    auto redraw = [&](bool force) {
+        int percent = tracker.percent();
+        std::string status = tracker.status(start);
+        if (!force && percent == last_percent && status == last_status) return;
+        last_percent = percent;
+        last_status = status;
+        int max_status = std::max(0, get_terminal_width() - 32);
+        draw_progress_bar(percent, false, status.substr(0, max_status));
+    };
+
+    redraw(true);
+    int exit_code = exec_stream(cmd, [&](const std::string& line, bool) {
+        log += line;
+        log += '\n';
+        if (tracker.feed(line)) redraw(false);
+    }, [&]() { redraw(false); }, 1000, opts);
+
+    if (exit_code != 0) {
+        draw_progress_bar(100, true);
+        std::cout << std::endl;
+
+        std::string log_path = get_cache_dir() + "/last-failure.log";
+        save_failure_log("$ " + join_command(cmd) + "\n" + log, log_path);
+
+        std::cout << RED << action << " failed (exit code " << exit_code << "). Output:" << RESET << std::endl;
+        std::cout << log;
+        std::cout << YELLOW << "Full log saved to " << log_path << RESET << std::endl;
+        return false;
+    }
+
+    draw_progress_bar(100);
+    std::cout << std::endl;
+    return true;
+}
+
+// One command in a multi-stage run (system update stages, AUR builds), with
+// the output and progress it has seen so far.
+struct Stage {
+    enum class State { Waiting, Running, Done, Failed, Skipped };
+
+    std::string name;
+    std::string trace_name;
+    std::vector<std::string> cmd;
+    ExecOptions opts;
+    State state = State::Waiting;
+    std::string note;
+    int exit_code = 0;
+    std::string log;
+    ProgressTracker tracker;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+};
+
+std::string format_duration(std::chrono::steady_clock::duration d) {
+    int secs = (int)std::chrono::duration_cast<std::chrono::seconds>(d).count();
+    return std::to_string(secs / 60) + ":" + (secs % 60 < 10 ? "0" : "") + std::to_string(secs % 60);
+}
+
+// Runs stages from several threads and keeps one progress line per stage on
+// the terminal. With --full-log, or when stdout isn't a terminal,
+// output is streamed instead, one prefixed line at a time.
+class StageBoard {
+public:
+    explicit StageBoard(std::vector<Stage>& stages)
+        : stages_(stages), live_(isatty(STDOUT_FILENO) && !g_full_log) {
+        for (const auto& stage : stages_) name_width_ = std::max(name_width_, stage.name.size() + 2);
+    }
+
+    bool run(Stage& stage) {
+        return run(stage, [&](const std::function<void(const std::string&)>& emit) {
+            return exec_stream(stage.cmd, [&](const std::string& line, bool) { emit(line); }, [&]() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                draw();
+            }, 1000, stage.opts);
+        });
+    }
+
+    // Runs work done in-process as a stage. task reports progress through
+    // emit(), in the same line format commands' output is read in, and
+    // returns an exit code.
+    bool run(Stage& stage, const std::function<int(const std::function<void(const std::string&)>&)>& task) {
+        TracePhase phase(stage.trace_name.c_str());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stage.state = Stage::State::Running;
+            stage.start = std::chrono::steady_clock::now();
+            if (!live_) std::cout << CYAN << "[" << stage.name << "] " << (stage.cmd.empty() ? "started" : join_command(stage.cmd)) << RESET << std::endl;
+            draw();
+        }
+
+        int code = task([&](const std::string& line) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stage.log += line;
+            stage.log += '\n';
+            bool changed = stage.tracker.feed(line);
+            if (g_full_log) std::cout << "[" << stage.name << "] " << line << std::endl;
+            else if (changed) draw();
+        });
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stage.end = std::chrono::steady_clock::now();
+        stage.exit_code = code;
+        stage.state = code == 0 ? Stage::State::Done : Stage::State::Failed;
+        if (!live_) {
+            std::cout << (code == 0 ? GREEN : RED) << "[" << stage.name << "] "
+                      << (code == 0 ? "done" : "failed (exit code " + std::to_string(code) + ")") << RESET << std::endl;
+        }
+        draw();
+        return code == 0;
+    }
+
+    void skip(Stage& stage, const std::string& note) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stage.state = Stage::State::Skipped;
+        stage.note = note;
+        draw();
+    }
+
+    void draw() {
+        if (!live_) return;
+        if (drawn_) std::cout << "\033[" << stages_.size() << "A";
+        for (const auto& stage : stages_) std::cout << "\r" << render(stage) << "\033[K\n";
+        std::cout << std::flush;
+        drawn_ = true;
+    }
+
+private:
+    std::vector<Stage>& stages_;
+    bool live_;
+    bool drawn_ = false;
+    size_t name_width_ = 9;
+    std::mutex mutex_;
+
+    std::string render(const Stage& stage) const {
+        std::ostringstream line;
+        line << "  " << std::left << std::setw(name_width_) << stage.name;
+        int bar_width = std::min(40, get_terminal_width() - 60);
+        switch (stage.state) {
+            case Stage::State::Waiting:
+                line << "waiting" << (stage.note.empty() ? "" : " for " + stage.note);
+                break;
+            case Stage::State::Skipped:
+                line << YELLOW << "skipped (" << stage.note << ")" << RESET;
+                break;
+            case Stage::State::Running: {
+                std::string status = stage.tracker.status(stage.start);
+                line << render_progress_bar(stage.tracker.percent(), false, bar_width) << " "
+                     << status.substr(0, std::max(0, get_terminal_width() - bar_width - 16));
+                break;
+            }
+            case Stage::State::Done:
+                line << render_progress_bar(100, false, bar_width) << " " << GREEN << "done in "
+                     << format_duration(stage.end - stage.start) << RESET;
+                break;
+            case Stage::State::Failed:
+                line << render_progress_bar(100, true, bar_width) << " " << RED << "exit code " << stage.exit_code << RESET;
+                break;
+        }
+        return line.str();
+    }
+};
+
+// Repo package downloads done by rinse instead of pacman, so a transaction
+// finds everything already in pacman's cache. pacman -Sp plans the files
+// (dependencies included) with their sizes and SHA-256 sums; each file is
+// then given to one of the first download_mirrors mirrors of its repo, one
+// curl per mirror with parallel transfers on reused connections. Files
+// that fail go to the next mirror in the following round, and partial
+// downloads resume where they stopped. Only verified files are moved into
+// the cache; pacman still checks signatures itself.
+struct DownloadItem {
+    std::string repo;
+    std::string name;
+    std::string filename;
+    uint64_t size = 0;
+    std::string sha256;
+};
+
+const std::string PACMAN_CACHE_DIR = "/var/cache/pacman/pkg";
+
+// Files a pacman -S (or -Su) with these arguments would download.
+std::vector<DownloadItem> download_plan(const std::vector<std::string>& args) {
+    std::vector<std::string> cmd = {"pacman", "--dbpath", g_dbpath, "--config", g_config.pacman_conf, "-Sp",
+                                    "--print-format", "%r %n %f %s %h"};
+    cmd.insert(cmd.end(), args.begin(), args.end());
+    std::vector<DownloadItem> items;
+    exec_lines(cmd, [&](const std::string& line) {
+        std::istringstream in(line);
+        DownloadItem item;
+        if (in >> item.repo >> item.name >> item.filename >> item.size >> item.sha256 && item.sha256.size() == 64) {
+            std::error_code ec;
+            // Already cached (pacman verifies those itself).
+            if (fs::file_size(PACMAN_CACHE_DIR + "/" + item.filename, ec) != item.size || ec) items.push_back(item);
+        }
+    });
+    return items;
+}
+
+// Downloads items into pacman's cache. emit() gets progress in the format
+// ProgressTracker reads. Returns true if every file arrived and verified.
+bool download_packages(const std::vector<DownloadItem>& items, const std::function<void(const std::string&)>& emit) {
+    if (items.empty()) return true;
+    TracePhase phase("download");
+
+    std::map<std::string, std::vector<std::string>> mirrors;
+    for (const auto& repo : pacman_repos(g_config.pacman_conf)) {
+        mirrors[repo.name] = repo.servers;
+        if (mirrors[repo.name].size() > (size_t)g_config.download_mirrors) mirrors[repo.name].resize(g_config.download_mirrors);
+    }
+
+    std::string staging = get_cache_dir() + "/download";
+    std::error_code ec;
+    fs::create_directories(staging, ec);
+    auto part_of = [&](const DownloadItem& item) { return staging + "/" + item.filename + ".part"; };
+    auto part_size = [&](const DownloadItem& item) {
+        std::error_code size_ec;
+        uint64_t size = fs::file_size(part_of(item), size_ec);
+        return size_ec ? 0 : size;
+    };
+
+    uint64_t total = 0;
+    for (const auto& item : items) total += item.size;
+    emit("Total Download Size: " + format_bytes(total));
+
+    std::vector<char> verified(items.size(), 0);
+    size_t max_rounds = 1;
+    for (const auto& [repo, servers] : mirrors) max_rounds = std::max(max_rounds, servers.size() + 1);
+
+    for (size_t round = 0; round < max_rounds; round++) {
+        // One curl per mirror, each with its share of the remaining files.
+        std::map<std::string, std::vector<std::string>> by_mirror;
+        std::vector<uint64_t> before(items.size(), 0);
+        for (size_t i = 0; i < items.size(); i++) {
+            if (verified[i]) continue;
+            const auto& servers = mirrors[items[i].repo];
+            if (servers.empty()) continue;
+            const std::string& server = servers[(i + round) % servers.size()];
+            before[i] = part_size(items[i]);
+            auto& args = by_mirror[server];
+            args.push_back("-o");
+            args.push_back(part_of(items[i]));
+            args.push_back(server + "/" + items[i].filename);
+        }
+        if (by_mirror.empty()) break;
+
+        std::vector<std::vector<std::string>> cmds;
+        for (auto& [server, args] : by_mirror) {
+            std::vector<std::string> cmd = {"curl", "-sL", "--fail", "--connect-timeout", "10", "-C", "-", "-Z", "--parallel-max", "4"};
+            cmd.insert(cmd.end(), args.begin(), args.end());
+            cmds.push_back(std::move(cmd));
+        }
+
+        std::atomic<bool> running(true);
+        std::thread monitor([&]() {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t start_bytes = 0;
+            for (size_t i = 0; i < items.size(); i++) start_bytes += verified[i] ? items[i].size : part_size(items[i]);
+            while (running) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(250));
+                uint64_t bytes = 0;
+                size_t done = 0;
+                for (size_t i = 0; i < items.size(); i++) {
+                    uint64_t have = verified[i] ? items[i].size : part_size(items[i]);
+                    bytes += have;
+                    done += have >= items[i].size;
+                }
+                double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                std::string line = "(" + std::to_string(done) + "/" + std::to_string(items.size()) + ") downloading " +
+                                   format_bytes(bytes) + " of " + format_bytes(total);
+                if (secs > 0.5) line += "  " + format_bytes((bytes - std::min(bytes, start_bytes)) / secs) + "/s";
+                emit(line);
+            }
+        });
+        parallel_for(cmds.size(), [&](size_t k) { exec_status(cmds[k]); }, cmds.size());
+        running = false;
+        monitor.join();
+
+        parallel_for(items.size(), [&](size_t i) {
+            if (verified[i]) return;
+            uint64_t size = part_size(items[i]);
+            std::error_code item_ec;
+            if (size == items[i].size && Sha256::file(part_of(items[i])) == items[i].sha256) {
+                fs::rename(part_of(items[i]), staging + "/" + items[i].filename, item_ec);
+                verified[i] = !item_ec;
+            } else if (size >= items[i].size || size <= before[i]) {
+                // Corrupt, or the mirror couldn't resume it: start over elsewhere.
+                fs::remove(part_of(items[i]), item_ec);
+            }
+        });
+        if (std::all_of(verified.begin(), verified.end(), [](char v) { return v; })) break;
+    }
+
+    std::vector<std::string> ready;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (verified[i]) ready.push_back(staging + "/" + items[i].filename);
+    }
+    bool moved = true;
+    if (!ready.empty() && access(PACMAN_CACHE_DIR.c_str(), W_OK) == 0) {
+        for (const auto& path : ready) {
+            std::string target = PACMAN_CACHE_DIR + "/" + fs::path(path).filename().string();
+            fs::rename(path, target, ec);
+            if (ec) {
+                fs::copy_file(path, target, fs::copy_options::overwrite_existing, ec);
+                moved &= !ec;
+                fs::remove(path, ec);
+            }
+        }
+    } else if (!ready.empty()) {
+        std::vector<std::string> cmd = {"sudo", "install", "-m", "644", "-o", "root", "-g", "root", "-t", PACMAN_CACHE_DIR, "--"};
+        cmd.insert(cmd.end(), ready.begin(), ready.end());
+        moved = exec_status(cmd) == 0;
+        for (const auto& path : ready) fs::remove(path, ec);
+    }
+    emit("(" + std::to_string(ready.size()) + "/" + std::to_string(items.size()) + ") downloaded");
+    return moved && ready.size() == items.size();
+}
+
+// Downloads what `pacman -S args` will need ahead of the transaction, on a
+// one-line board. Anything that fails is left for pacman to fetch.
+void predownload(const std::vector<std::string>& args) {
+    if (g_dry_run || g_config.download_mirrors <= 0) return;
+    std::vector<DownloadItem> items = download_plan(args);
+    if (items.empty()) return;
+
+    std::vector<Stage> stages(1);
+    stages[0].name = "download";
+    stages[0].trace_name = "stage: download";
+    StageBoard board(stages);
+    board.draw();
+    bool ok = board.run(stages[0], [&](const std::function<void(const std::string&)>& emit) {
+        return download_packages(items, emit) ? 0 : 1;
+    });
+    if (!ok) board.skip(stages[0], "pacman downloads the rest");
+}
+
+// Native AUR builds. The requested packages and their AUR dependencies are
+// cloned (or fetched) under ~/.cache/rinse/aur-build, .SRCINFO decides
+// what each one needs, and the result is built as a DAG: every level is
+// built by up to build_jobs concurrent makepkg workers and then installed
+// with one pacman -U, so the next level finds its dependencies in place.
+// Repo dependencies of the whole tree go in with a single pacman -S first.
+struct AurBuild {
+    std::string base;
+    std::string version;
+    std::vector<std::string> pkgnames;
+    std::vector<std::string> depends;      // pkgbase's depends, makedepends and checkdepends
+    std::map<std::string, std::vector<std::string>> package_depends;   // the same, per pkgname section
+    std::set<std::string> wanted;          // pkgnames that will be installed
+    bool explicit_install = false;
+    std::set<size_t> needs;                // other builds that must be installed first
+    int level = -1;
+    bool vcs = false;                      // builds from an unpinned VCS source, so is never cached
+};
+
+bool parse_srcinfo(const std::string& path, AurBuild& build) {
+    std::ifstream file(path);
+    if (!file) return false;
+
+    static const std::string machine = machine_arch();
+    std::string line, pkgver, pkgrel, epoch;
+    std::vector<std::string>* depends = &build.depends;
+    while (std::getline(file, line)) {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = trim(line.substr(0, eq));
+        std::string val = trim(line.substr(eq + 1));
+
+        // Architecture-specific lists ("depends_aarch64") only count for this machine.
+        size_t arch = key.find('_');
+        if (arch != std::string::npos) {
+            if (key.substr(arch + 1) != machine) continue;
+            key = key.substr(0, arch);
+        }
+
+        if (key == "pkgbase") depends = &build.depends;
+        else if (key == "pkgname") {
+            build.pkgnames.push_back(val);
+            depends = &build.package_depends[val];
+        }
+        else if (key == "pkgver") pkgver = val;
+        else if (key == "pkgrel") pkgrel = val;
+        else if (key == "epoch") epoch = val;
+        else if (key == "source") {
+            // "name::git+https://...#commit=abc" is pinned; a bare branch checkout is not
+            std::string url = val.substr(val.find("::") == std::string::npos ? 0 : val.find("::") + 2);
+            bool vcs = false;
+            for (const char* scheme : {"git+", "git://", "svn+", "svn://", "hg+", "bzr+", "fossil+"}) {
+                if (url.rfind(scheme, 0) == 0) vcs = true;
+            }
+            bool pinned = url.find("#commit=") != std::string::npos || url.find("#tag=") != std::string::npos ||
+                          url.find("#revision=") != std::string::npos;
+            if (vcs && !pinned) build.vcs = true;
+        }
+        else if (key == "depends" || key == "makedepends" || key == "checkdepends") {
+            std::string name = dependency_name(val);
+            if (std::find(depends->begin(), depends->end(), name) == depends->end()) depends->push_back(name);
+        }
+    }
+    build.version = (epoch.empty() ? "" : epoch + ":") + pkgver + "-" + pkgrel;
+    return !build.pkgnames.empty();
+}
+
+// What building a base's wanted packages needs: the pkgbase lists plus the
+// wanted pkgname sections', not those of split packages nobody asked for.
+std::vector<std::string> build_depends(const AurBuild& build) {
+    std::vector<std::string> result = build.depends;
+    for (const auto& name : build.wanted) {
+        auto it = build.package_depends.find(name);
+        if (it == build.package_depends.end()) continue;
+        for (const auto& dep : it->second) {
+            if (std::find(result.begin(), result.end(), dep) == result.end()) result.push_back(dep);
+        }
+    }
+    return result;
+}
+
+std::string aur_build_dir() {
+    return get_cache_dir() + "/aur-build";
+}
+
+// Clones <aur_clone_url>/<base>.git, or fast-forwards an existing clone.
+bool aur_checkout(const std::string& base) {
+    std::string dir = aur_build_dir() + "/" + base;
+    std::error_code ec;
+    if (fs::is_directory(dir + "/.git", ec)) {
+        return exec_status({"git", "-C", dir, "pull", "-q", "--ff-only"}) == 0;
+    }
+    fs::remove_all(dir, ec);
+    fs::create_directories(aur_build_dir(), ec);
+    return exec_status({"git", "clone", "-q", "--depth=1", g_config.aur_clone_url + "/" + base + ".git", dir}) == 0;
+}
+
+// Package files makepkg produced for this build, keyed by pkgname.
+std::map<std::string, std::string> aur_built_packages(const std::string& dir) {
+    std::map<std::string, std::string> files;
+    ExecOptions in_dir;
+    in_dir.cwd = dir;
+    exec_lines({"makepkg", "--packagelist"}, [&](const std::string& path) {
+        PackageFileName file;
+        if (parse_package_file_name(fs::path(path).filename().string(), file)) files[file.name] = path;
+    }, in_dir);
+    return files;
+}
+
+// Build cache. A finished build is stored under a SHA-256 of everything
+// that decides what makepkg produces: the git-tracked build files (the
+// PKGBUILD, .SRCINFO with its source checksums, patches and install
+// scripts), the makepkg.conf settings that reach the compiler or the
+// package, and the installed versions of the build's dependencies. The
+// directory may be shared between machines, so entries are copied under a
+// temporary name and renamed into place; readers never see half an entry.
+std::string build_cache_dir() {
+    return g_config.build_cache_dir.empty() ? get_cache_dir() + "/packages" : g_config.build_cache_dir;
+}
+
+// The makepkg.conf lines (system, drop-ins, then the user's) that change a
+// build's output. Paths, packager identity and MAKEFLAGS don't.
+std::string makepkg_flags() {
+    const char* conf = getenv("MAKEPKG_CONF");
+    std::vector<std::string> files = {conf && *conf ? conf : "/etc/makepkg.conf"};
+    std::error_code ec;
+    std::vector<std::string> drop_ins;
+    for (const auto& entry : fs::directory_iterator(files[0] + ".d", ec)) {
+        if (entry.path().extension() == ".conf") drop_ins.push_back(entry.path().string());
+    }
+    std::sort(drop_ins.begin(), drop_ins.end());
+    files.insert(files.end(), drop_ins.begin(), drop_ins.end());
+    const char* xdg = getenv("XDG_CONFIG_HOME");
+    std::string user = (xdg && *xdg ? std::string(xdg) : get_home() + "/.config") + "/pacman/makepkg.conf";
+    files.push_back(fs::exists(user, ec) ? user : get_home() + "/.makepkg.conf");
+
+    static const std::set<std::string> keys = {
+        "CARCH", "CHOST", "CPPFLAGS", "CFLAGS", "CXXFLAGS", "LDFLAGS", "LTOFLAGS", "RUSTFLAGS",
+        "DEBUG_CFLAGS", "DEBUG_CXXFLAGS", "DEBUG_RUSTFLAGS", "BUILDENV", "OPTIONS", "PKGEXT"};
+    std::string flags;
+    for (const auto& path : files) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            line = trim(line);
+            if (line.rfind("export ", 0) == 0) line = trim(line.substr(7));
+            size_t eq = line.find('=');
+            if (eq == std::string::npos || line[0] == '#') continue;
+            std::string key = line.substr(0, eq);
+            if (!key.empty() && key.back() == '+') key.pop_back();
+            if (keys.count(key)) flags += line + "\n";
+        }
+    }
+    return flags;
+}
+
+// Cache key for a checked-out build, or "" if its output can't be predicted.
+std::string aur_build_key(const AurBuild& build, const std::string& flags, const LocalDB& installed) {
+    if (build.vcs) return "";
+    std::string dir = aur_build_dir() + "/" + build.base;
+    std::vector<std::string> tracked;
+    if (exec_lines({"git", "-C", dir, "ls-files"}, [&](const std::string& file) { tracked.push_back(file); }) != 0 ||
+        tracked.empty()) {
+        return "";
+    }
+    std::sort(tracked.begin(), tracked.end());
+
+    Sha256 sha;
+    sha.update("rinse build cache 1\n");
+    for (const auto& file : tracked) {
+        std::string digest = Sha256::file(dir + "/" + file);
+        if (digest.empty()) return "";
+        sha.update(file + " " + digest + "\n");
+    }
+    sha.update(flags);
+    for (const auto& dep : build_depends(build)) {
+        const LocalPackage* pkg = installed.find(dep);
+        for (size_t i = 0; !pkg && i < installed.packages().size(); i++) {
+            for (const auto& provided : installed.packages()[i].provides) {
+                if (dependency_name(provided) == dep) pkg = &installed.packages()[i];
+            }
+        }
+        sha.update(dep + "=" + (pkg ? pkg->name + " " + pkg->version : "?") + "\n");
+    }
+    return sha.hex();
+}
+
+// Cached package files for key, keyed by pkgname (empty on a miss).
+std::map<std::string, std::string> build_cache_lookup(const std::string& key) {
+    std::map<std::string, std::string> files;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(build_cache_dir() + "/" + key, ec)) {
+        PackageFileName file;
+        if (parse_package_file_name(entry.path().filename().string(), file)) files[file.name] = entry.path().string();
+    }
+    return files;
+}
+
+bool build_cache_store(const std::string& key, const std::map<std::string, std::string>& files) {
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    std::string dir = build_cache_dir() + "/" + key;
+    std::string tmp = build_cache_dir() + "/." + key + "." + host + "." + std::to_string(getpid());
+
+    std::error_code ec;
+    fs::create_directories(tmp, ec);
+    for (const auto& [name, path] : files) {
+        if (ec) break;
+        fs::copy_file(path, tmp + "/" + fs::path(path).filename().string(), fs::copy_options::overwrite_existing, ec);
+    }
+    // Someone else may have stored the same build meanwhile; theirs is as good as ours.
+    if (ec || rename(tmp.c_str(), dir.c_str()) != 0) {
+        fs::remove_all(tmp, ec);
+        return fs::is_directory(dir, ec);
+    }
+    return true;
+}
+
+// Resolves names into an ordered set of AUR builds plus the repo packages
+// they need. Returns false (after saying why) if anything can't be found.
+bool aur_plan(const std::vector<std::string>& names, std::vector<AurBuild>& builds, std::vector<std::string>& repo_deps) {
+    std::set<std::string> installed;
+    for (const auto& pkg : local_db().packages()) {
+        installed.insert(pkg.name);
+        for (const auto& provided : pkg.provides) installed.insert(dependency_name(provided));
+    }
+
+    std::map<std::string, size_t> by_base;
+    std::map<std::string, size_t> by_pkgname;
+    std::set<std::string> repo_set;
+    std::set<std::string> seen(names.begin(), names.end());
+    std::map<std::string, std::string> wanted_by;
+    bool ok = true;
+
+    std::vector<std::string> pending = names;
+    bool explicit_level = true;
+    while (!pending.empty()) {
+        aur_prefetch(pending);
+
+        std::vector<size_t> fresh;
+        for (const auto& name : pending) {
+            const AurPackage* info = aur_lookup(name);
+            if (!info) {
+                std::cout << RED << "\"" << name << "\"" << (explicit_level ? "" : " (needed by " + wanted_by[name] + ")")
+                          << " was not found in the repos or the AUR" << RESET << std::endl;
+                ok = false;
+                continue;
+            }
+            std::string base = sanitize_package(info->package_base.empty() ? info->name : info->package_base);
+            auto it = by_base.find(base);
+            if (it == by_base.end()) {
+                it = by_base.emplace(base, builds.size()).first;
+                builds.push_back({});
+                builds.back().base = base;
+                fresh.push_back(it->second);
+            }
+            builds[it->second].wanted.insert(name);
+            builds[it->second].explicit_install |= explicit_level;
+            by_pkgname[name] = it->second;
+        }
+
+        std::vector<char> fetched(fresh.size(), 0);
+        if (!fresh.empty()) {
+            std::cout << CYAN << "Fetching " << fresh.size() << " AUR package build" << (fresh.size() == 1 ? "" : "s") << "..." << RESET << std::endl;
+        }
+        parallel_for(fresh.size(), [&](size_t i) {
+            fetched[i] = aur_checkout(builds[fresh[i]].base) &&
+                         parse_srcinfo(aur_build_dir() + "/" + builds[fresh[i]].base + "/.SRCINFO", builds[fresh[i]]);
+        });
+
+        std::vector<std::string> next;
+        for (size_t i = 0; i < fresh.size(); i++) {
+            AurBuild& build = builds[fresh[i]];
+            if (!fetched[i]) {
+                std::cout << RED << "Could not fetch the build files for " << build.base << RESET << std::endl;
+                ok = false;
+                continue;
+            }
+            for (const auto& pkgname : build.pkgnames) by_pkgname.emplace(pkgname, fresh[i]);
+        }
+        // A dependency on another package of a base we already have adds
+        // that package's own section, so go round until nothing new turns up.
+        for (bool grew = true; grew;) {
+            grew = false;
+            for (size_t i = 0; i < builds.size(); i++) {
+                for (const auto& dep : build_depends(builds[i])) {
+                    if (installed.count(dep) || repo_set.count(dep)) continue;
+                    auto it = by_pkgname.find(dep);
+                    if (it != by_pkgname.end()) {
+                        grew |= builds[it->second].wanted.insert(dep).second;
+                        continue;
+                    }
+                    SyncPackage repo_pkg;
+                    if (sync_index().find(dep, &repo_pkg) || sync_index().find_provider(dep, &repo_pkg)) {
+                        if (repo_set.insert(dep).second) repo_deps.push_back(repo_pkg.name);
+                    } else if (seen.insert(dep).second) {
+                        wanted_by[dep] = builds[i].base;
+                        next.push_back(dep);
+                    }
+                }
+            }
+        }
+        pending = next;
+        explicit_level = false;
+    }
+    if (!ok) return false;
+
+    // Edges between builds, then levels (Kahn's algorithm).
+    for (size_t i = 0; i < builds.size(); i++) {
+        for (const auto& dep : build_depends(builds[i])) {
+            auto it = by_pkgname.find(dep);
+            if (it == by_pkgname.end() || installed.count(dep)) continue;
+            if (it->second != i) builds[i].needs.insert(it->second);
+        }
+    }
+
+    size_t placed = 0;
+    for (int level = 0; placed < builds.size(); level++) {
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < builds.size(); i++) {
+            if (builds[i].level >= 0) continue;
+            bool can_build = true;
+            for (size_t need : builds[i].needs) {
+                if (builds[need].level < 0 || builds[need].level == level) can_build = false;
+            }
+            if (can_build) ready.push_back(i);
+        }
+        if (ready.empty()) {
+            std::cout << RED << "AUR dependency cycle between:";
+            for (const auto& build : builds) {
+                if (build.level < 0) std::cout << " " << build.base;
+            }
+            std::cout << RESET << std::endl;
+            return false;
+        }
+        for (size_t i : ready) builds[i].level = level;
+        placed += ready.size();
     }
 
-    std::string response;
-    std::getline(std::cin, response);
-    response = trim(response);
+    std::stable_sort(builds.begin(), builds.end(), [](const AurBuild& a, const AurBuild& b) { return a.level < b.level; });
+    return true;
+}
 
-    if (response == "yes") {
-        g_auto_confirm = true;
-        return true;
+// Builds and installs a plan from aur_plan.
+bool aur_install(const std::vector<std::string>& names, const std::vector<AurBuild>& builds,
+                 const std::vector<std::string>& repo_deps) {
+    std::cout << BOLD << "\nAUR build order" << RESET << " (" << g_config.build_jobs << " parallel job"
+              << (g_config.build_jobs == 1 ? "" : "s") << "):" << std::endl;
+    if (!repo_deps.empty()) std::cout << "  repo dependencies: " << join(repo_deps, " ") << std::endl;
+    for (size_t i = 0; i < builds.size();) {
+        std::vector<std::string> level_names;
+        size_t j = i;
+        for (; j < builds.size() && builds[j].level == builds[i].level; j++) {
+            level_names.push_back(builds[j].base + " " + builds[j].version);
+        }
+        std::cout << "  " << builds[i].level + 1 << ". " << join(level_names, ", ") << std::endl;
+        i = j;
     }
 
-    if (response.empty()) return default_yes;
-    return (response[0] == 'y' || response[0] == 'Y');
-}
+    if (!repo_deps.empty()) {
+        std::vector<std::string> cmd = {"sudo", "pacman", "-S", "--needed", "--asdeps", "--noconfirm"};
+        cmd.insert(cmd.end(), repo_deps.begin(), repo_deps.end());
+        if (!show_progress(cmd, "Installing dependencies")) return false;
+    }
 
-int get_terminal_width() {
-    struct winsize w;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-    int width = w.ws_col > 0 ? w.ws_col : 80;
-    return std::min(width, 120); // Cap at 120 chars
-}
+    std::string flags = makepkg_flags();
+    for (size_t i = 0; i < builds.size();) {
+        size_t end = i;
+        while (end < builds.size() && builds[end].level == builds[i].level) end++;
+
+        // Earlier levels are installed by now, so their versions are part of the keys.
+        LocalDB installed;
+        installed.load(g_dbpath);
+        std::vector<std::string> keys(end - i);
+        std::vector<std::map<std::string, std::string>> files(end - i);
+        {
+            TracePhase phase("build cache");
+            parallel_for(keys.size(), [&](size_t k) {
+                keys[k] = aur_build_key(builds[i + k], flags, installed);
+                if (keys[k].empty()) return;
+                files[k] = build_cache_lookup(keys[k]);
+                for (const auto& pkgname : builds[i + k].wanted) {
+                    if (!files[k].count(pkgname)) files[k].clear();
+                }
+            });
+        }
 
-void draw_progress_bar(int percent, bool failed = false) {
-    int width = get_terminal_width();
-    int bar_width = width - 10;
+        std::vector<size_t> to_build;
+        for (size_t k = 0; k < keys.size(); k++) {
+            if (files[k].empty()) {
+                to_build.push_back(k);
+            } else {
+                std::cout << GREEN << "Using cached build of " << builds[i + k].base << " " << builds[i + k].version << RESET << std::endl;
+            }
+        }
 
-    if (bar_width < 20) bar_width = 20;
+        std::vector<Stage> stages(to_build.size());
+        for (size_t n = 0; n < stages.size(); n++) {
+            const AurBuild& build = builds[i + to_build[n]];
+            stages[n].name = build.base;
+            stages[n].trace_name = "build: " + build.base;
+            stages[n].cmd = {"makepkg", "-f", "--noconfirm"};
+            if (!g_keep && !g_config.keep_build) stages[n].cmd.push_back("-c");
+            stages[n].opts.cwd = aur_build_dir() + "/" + build.base;
+        }
 
-    std::string center_text = failed ? "FAILED" : std::to_string(percent) + "%";
-    int filled = failed ? bar_width : (percent * bar_width) / 100;
+        if (g_dry_run) {
+            for (const auto& stage : stages) {
+                std::cout << YELLOW << "[DRY RUN] Would execute: " << RESET << join_command(stage.cmd) << " (in " << stage.opts.cwd << ")\n";
+            }
+            i = end;
+            continue;
+        }
 
-    int center_pos = bar_width / 2 - center_text.length() / 2;
+        bool ok = true;
+        std::vector<char> failed(keys.size(), 0);
+        if (!stages.empty()) {
+            std::cout << CYAN << "\nBuilding level " << builds[i].level + 1 << "..." << RESET << std::endl;
+            StageBoard board(stages);
+            board.draw();
+            std::vector<char> built(stages.size(), 0);
+            parallel_for(stages.size(), [&](size_t n) { built[n] = board.run(stages[n]); }, g_config.build_jobs);
+
+            for (size_t n = 0; n < stages.size(); n++) {
+                size_t k = to_build[n];
+                if (!built[n]) {
+                    std::cout << RED << "\nBuilding " << builds[i + k].base << " failed. Output:" << RESET << std::endl;
+                    if (!g_full_log) std::cout << stages[n].log;
+                    std::string log_path = get_cache_dir() + "/last-failure.log";
+                    save_failure_log("$ " + join_command(stages[n].cmd) + "\n" + stages[n].log, log_path);
+                    std::cout << YELLOW << "Full log saved to " << log_path << RESET << std::endl;
+                    failed[k] = 1;
+                    ok = false;
+                    continue;
+                }
+                files[k] = aur_built_packages(stages[n].opts.cwd);
+                if (!keys[k].empty() && !files[k].empty() && !build_cache_store(keys[k], files[k])) {
+                    std::cout << YELLOW << "Could not store " << builds[i + k].base << " in " << build_cache_dir() << RESET << std::endl;
+                }
+            }
+        }
 
-    std::cout << "\r[";
+        std::vector<std::string> as_deps, as_explicit;
+        for (size_t k = 0; k < keys.size(); k++) {
+            if (failed[k]) continue;
+            for (const auto& pkgname : builds[i + k].wanted) {
+                auto it = files[k].find(pkgname);
+                if (it == files[k].end()) {
+                    std::cout << RED << "makepkg did not produce a package for " << pkgname << RESET << std::endl;
+                    ok = false;
+                    continue;
+                }
+                bool requested = std::find(names.begin(), names.end(), pkgname) != names.end();
+                (requested ? as_explicit : as_deps).push_back(it->second);
+            }
+        }
 
-    for (int i = 0; i < bar_width; i++) {
-        if (i >= center_pos && i < center_pos + (int)center_text.length()) {
-            std::cout << (failed ? RED : RESET) << BOLD << center_text[i - center_pos] << RESET;
-        } else if (i < filled) {
-            std::cout << (failed ? RED : GREEN) << "=";
-        } else {
-            std::cout << RED << "-";
+        if (!as_deps.empty()) {
+            std::vector<std::string> cmd = {"sudo", "pacman", "-U", "--asdeps", "--noconfirm"};
+            cmd.insert(cmd.end(), as_deps.begin(), as_deps.end());
+            ok &= show_progress(cmd, "Installing");
         }
+        if (!as_explicit.empty()) {
+            std::vector<std::string> cmd = {"sudo", "pacman", "-U", "--noconfirm"};
+            cmd.insert(cmd.end(), as_explicit.begin(), as_explicit.end());
+            ok &= show_progress(cmd, "Installing");
+        }
+        if (!ok) return false;
+        i = end;
     }
-
-    std::cout << RESET << "]" << std::flush;
+    return true;
 }
 
-void show_progress(const std::string& cmd, const std::string& action = "Processing") {
-    if (g_dry_run) {
-        std::cout << YELLOW << "[DRY RUN] Would execute: " << RESET << cmd << "\n";
-        return;
-    }
+enum class PackageSource { None, Pacman, Aur, Flatpak };
+
+// Everything install_packages needs to know about one argument, gathered
+// before the user is asked anything.
+struct Resolution {
+    std::string arg;
+    std::string name;
+    PackageSource source = PackageSource::None;
+    bool installed = false;
+    bool outdated = false;
+    std::string version;
+    time_t date = 0;
+    time_t flagged = 0;
+    std::string installed_match;
+    std::vector<std::string> suggestions;
+    std::string flatpak_id;
+    std::string flatpak_remote;
+};
 
-    if (g_full_log) {
-        int status = system(cmd.c_str());
-        if (status != 0) {
-            std::cout << RED << "✗ Operation failed" << RESET << std::endl;
-        }
-        return;
+Resolution resolve_package(const std::string& pkg, bool have_flatpak) {
+    Resolution r;
+    r.arg = pkg;
+    r.name = sanitize_package(pkg);
+
+    std::string bare = r.name.substr(r.name.find('/') + 1);
+    r.installed = local_db().find(bare) != nullptr;
+
+    SyncPackage repo_pkg;
+    if (sync_index().find(r.name, &repo_pkg)) {
+        r.source = PackageSource::Pacman;
+        r.version = repo_pkg.version;
+        r.date = repo_pkg.build_date;
+    } else if (const AurPackage* aur_pkg = aur_lookup(r.name)) {
+        r.source = PackageSource::Aur;
+        r.version = aur_pkg->version;
+        r.date = aur_pkg->last_modified;
+        r.flagged = aur_pkg->out_of_date;
     }
 
-    // Pre-authenticate sudo to avoid password prompt during progress bar
-    if (cmd.find("sudo") != std::string::npos) {
-        system("sudo -v");
+    if (r.source != PackageSource::None) {
+        r.outdated = r.installed && is_outdated(bare);
+        return r;
     }
 
-    std::atomic<bool> done(false);
-    std::atomic<int> exit_code(0);
-
-    std::thread worker([&]() {
-        std::string silent_cmd = cmd + " > /dev/null 2>&1";
-        exit_code = system(silent_cmd.c_str());
-        done = true;
-    });
-
-    // Small delay to let sudo authenticate before showing progress
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto matches = name_index().suggest(bare, 3);
+    if (!matches.empty() && matches[0].installed) {
+        r.installed_match = matches[0].name;
+        return r;
+    }
 
-    int percent = 0;
-    auto start = std::chrono::steady_clock::now();
+    // A one-letter typo of a repo name is a better answer than a Flatpak
+    // app that merely mentions the word.
+    if ((matches.empty() || matches[0].distance > 1) && have_flatpak) {
+        auto found = flatpak_search(r.name);
+        if (!found.empty()) {
+            r.source = PackageSource::Flatpak;
+            r.flatpak_id = sanitize_package(found[0].id);
+            r.flatpak_remote = sanitize_package(found[0].remote);
+            r.name = r.flatpak_id;
+            return r;
+        }
+    }
+    for (const auto& m : matches) r.suggestions.push_back(m.name);
+    return r;
+}
 
-    while (!done) {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+void print_install_plan(const std::vector<Resolution>& plan) {
+    auto source_name = [](PackageSource src) {
+        switch (src) {
+            case PackageSource::Pacman: return "pacman";
+            case PackageSource::Aur: return "AUR";
+            case PackageSource::Flatpak: return "flatpak";
+            default: return "";
+        }
+    };
 
-        percent = std::min(95, (int)(elapsed * 95 / 10000));
-        draw_progress_bar(percent);
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    size_t name_width = 7;
+    size_t version_width = 7;
+    for (const auto& r : plan) {
+        name_width = std::max(name_width, r.name.size());
+        version_width = std::max(version_width, r.version.size());
     }
 
-    worker.join();
-
-    if (exit_code != 0) {
-        draw_progress_bar(100, true);
-        std::cout << std::endl;
-        std::cout << RED << "Running with output for debugging:" << RESET << std::endl;
-        system(cmd.c_str());
-    } else {
-        draw_progress_bar(100);
-        std::cout << std::endl;
+    std::cout << BOLD << "\n  " << std::left << std::setw(name_width + 2) << "Package" << std::setw(9) << "Source"
+              << std::setw(version_width + 2) << "Version" << std::setw(16) << "Updated" << "Action" << RESET << std::endl;
+
+    for (const auto& r : plan) {
+        std::string action = r.outdated ? "upgrade" : (r.installed ? "reinstall" : "install");
+        const char* color = r.outdated ? GREEN : (r.installed ? YELLOW : RESET);
+        std::cout << "  " << std::left << std::setw(name_width + 2) << r.name << std::setw(9) << source_name(r.source)
+                  << std::setw(version_width + 2) << (r.version.empty() ? "-" : r.version)
+                  << std::setw(16) << (r.date ? time_ago(r.date) : "-") << color << action << RESET << std::endl;
+        if (r.flagged) {
+            std::cout << YELLOW << "    flagged out of date on the AUR since " << format_date(r.flagged) << RESET << std::endl;
+        }
     }
+    std::cout << std::endl;
 }
 
-void ensure_yay() {
-    if (check_command("yay")) return;
+// Resolves every argument on a worker pool. Shared lookups are warmed
+// first: the local and sync tables load once, all non-repo arguments go to
+// the AUR in one batched request, and the name index is built only if
+// something will need a suggestion.
+std::vector<Resolution> resolve_packages(const std::vector<std::string>& pkgs, bool have_flatpak) {
+    TracePhase phase("resolve");
+    // Lazily built shared state is loaded here, before the workers read it.
+    local_db();
+    upgradable();
+    std::vector<std::string> aur_candidates;
+    for (const auto& pkg : pkgs) {
+        if (!package_in_pacman(pkg)) aur_candidates.push_back(pkg);
+    }
+    aur_prefetch(aur_candidates);
+    report_aur_cache_age();
+    if (have_flatpak) appstream_catalog();
+    for (const auto& pkg : aur_candidates) {
+        if (!package_in_aur(pkg)) {
+            name_index();
+            break;
+        }
+    }
+
+    std::vector<Resolution> resolved(pkgs.size());
+    parallel_for(pkgs.size(), [&](size_t i) { resolved[i] = resolve_package(pkgs[i], have_flatpak); });
+    return resolved;
+}
 
-    if (!confirm(YELLOW + std::string("yay (AUR frontend) not found. Install?") + RESET, true)) {
-        std::cerr << RED << "Cannot install AUR packages without yay" << RESET << std::endl;
-        exit(1);
+// Downloads for an install, run in the background so the network time
+// hides behind AUR resolution and builds. Nothing is installed here: repo
+// packages land in pacman's cache (-Sw) and Flatpak refs are pulled without
+// being deployed, so the transactions that follow, in their usual order,
+// mostly read from disk. A failed prefetch is harmless; the transaction
+// downloads whatever is still missing itself.
+class Prefetch {
+public:
+    ~Prefetch() { wait(); }
+
+    void start(std::function<void()> work) { thread_ = std::thread(std::move(work)); }
+
+    void start(std::vector<std::vector<std::string>> cmds) {
+        start([cmds = std::move(cmds)]() {
+            for (const auto& cmd : cmds) exec_status(cmd);
+        });
     }
 
-    if (g_dry_run) {
-        std::cout << YELLOW << "[DRY RUN] Would install yay" << RESET << std::endl;
-        return;
+    void wait() {
+        if (thread_.joinable()) thread_.join();
     }
 
-    std::cout << CYAN << "Installing yay..." << RESET << std::endl;
-    system("cd /tmp && git clone https://aur.archlinux.org/yay.git && cd yay && makepkg -si --noconfirm");
-}
+private:
+    std::thread thread_;
+};
 
 void install_packages(const std::vector<std::string>& pkgs) {
-    std::vector<std::string> pacman_pkgs, aur_pkgs, flatpak_pkgs, not_found;
+    std::vector<std::string> pacman_pkgs, aur_pkgs;
+    std::vector<std::pair<std::string, std::string>> flatpak_pkgs;
+
+    bool have_flatpak = check_flatpak();
+    std::vector<Resolution> resolved = resolve_packages(pkgs, have_flatpak);
+
+    std::vector<Resolution> plan;
+    for (const auto& r : resolved) {
+        if (r.source != PackageSource::None) {
+            plan.push_back(r);
+        } else if (!r.installed_match.empty()) {
+            std::cout << YELLOW << "Package \"" << r.arg << "\" not found, but \"" << r.installed_match
+                      << "\" is already installed." << RESET << std::endl;
+        } else if (!r.suggestions.empty()) {
+            std::string options;
+            for (size_t i = 0; i < r.suggestions.size(); i++) {
+                if (i > 0) options += (i + 1 == r.suggestions.size()) ? " or " : ", ";
+                options += "\"" + r.suggestions[i] + "\"";
+            }
+            std::cout << YELLOW << "Package \"" << r.arg << "\" not found. Did you mean " << options << "?" << RESET << std::endl;
+        } else {
+            std::cout << RED << "Package \"" << r.arg << "\" not found on pacman, the AUR or Flatpak." << RESET << std::endl;
+            if (!have_flatpak) {
+                std::cout << YELLOW << "Flatpak is not installed, so it wasn't searched. Install it first with: rinse flatpak" << RESET << std::endl;
+            }
+            std::cout << "If the package is a .tar.gz file you want to install, run \"rinse <path/to/file>\"" << std::endl;
+        }
+    }
 
-    for (const auto& pkg : pkgs) {
-        bool installed = is_installed(pkg);
-        bool outdated = installed && is_outdated(pkg);
+    if (plan.empty()) return;
 
-        if (package_in_pacman(pkg)) {
-            std::string date = get_package_date_pacman(pkg);
+    print_install_plan(plan);
 
-            if (installed && !outdated) {
-                if (confirm(YELLOW + std::string("Package \"") + pkg + "\" already installed. Reinstall?" + RESET, false)) {
-                    pacman_pkgs.push_back(pkg);
-                }
-            } else if (outdated) {
-                if (confirm(YELLOW + std::string("Package \"") + pkg + "\" already installed, but outdated. Update?" + RESET, true)) {
-                    pacman_pkgs.push_back(pkg);
-                }
-            } else {
-                std::cout << GREEN << "Installing package \"" << pkg << "\" from pacman" << RESET << std::endl;
-                if (!date.empty()) {
-                    std::cout << "Last updated: " << date << " (" << time_ago(date) << ")" << std::endl;
-                }
-                if (confirm("", true)) {
-                    pacman_pkgs.push_back(pkg);
-                }
-            }
-        } else if (package_in_aur(pkg)) {
-            std::string date = get_package_date_aur(pkg);
+    // Default to "no" when the plan is only reinstalls or pulls in AUR packages.
+    bool default_yes = true;
+    bool only_reinstalls = true;
+    for (const auto& r : plan) {
+        if (r.source == PackageSource::Aur && !r.installed) default_yes = false;
+        if (!r.installed || r.outdated) only_reinstalls = false;
+    }
+    if (only_reinstalls) default_yes = false;
 
-            if (installed && !outdated) {
-                if (confirm(YELLOW + std::string("Package \"") + pkg + "\" already installed. Reinstall?" + RESET, false)) {
-                    aur_pkgs.push_back(pkg);
-                }
-            } else if (outdated) {
-                if (confirm(YELLOW + std::string("Package \"") + pkg + "\" already installed, but outdated. Update?" + RESET, true)) {
-                    aur_pkgs.push_back(pkg);
-                }
-            } else {
-                std::cout << BLUE << "Package \"" << pkg << "\" not found on pacman, but found on the AUR." << RESET << std::endl;
-                if (!date.empty()) {
-                    std::cout << "Last updated: " << date << " (" << time_ago(date) << ")" << std::endl;
-                }
-                if (confirm("", false)) {
-                    aur_pkgs.push_back(pkg);
-                }
-            }
-        } else {
-            // Check for installed packages with fuzzy match
-            std::string fuzzy = fuzzy_search_package(pkg);
-            if (!fuzzy.empty() && is_installed(fuzzy)) {
-                std::cout << YELLOW << "Package \"" << pkg << "\" not found, but \"" << fuzzy
-                         << "\" is already installed." << RESET << std::endl;
-            } else {
-                // Check pacman repos for fuzzy match
-                std::string search_result = exec("pacman -Ss '^" + sanitize_package(pkg) + "' 2>/dev/null | head -1");
-                if (!search_result.empty()) {
-                    std::string suggested = search_result.substr(0, search_result.find(' '));
-                    if (suggested.find('/') != std::string::npos) {
-                        suggested = suggested.substr(suggested.find('/') + 1);
-                    }
-                    std::cout << YELLOW << "Package \"" << pkg << "\" not found. Did you mean \""
-                             << suggested << "\"?" << RESET << std::endl;
-                    if (confirm("Install \"" + suggested + "\" instead?", false)) {
-                        pacman_pkgs.push_back(suggested);
-                    }
+    if (!confirm("Proceed with " + std::to_string(plan.size()) + " package" + (plan.size() == 1 ? "" : "s") + "?", default_yes)) {
+        return;
+    }
+
+    for (const auto& r : plan) {
+        if (r.source == PackageSource::Pacman) pacman_pkgs.push_back(r.name);
+        else if (r.source == PackageSource::Aur) aur_pkgs.push_back(r.name);
+        else if (r.source == PackageSource::Flatpak) flatpak_pkgs.push_back({r.flatpak_remote, r.flatpak_id});
+    }
+
+    bool ok = true;
+
+    // Only worth it when there's other work to overlap the downloads with.
+    // pacman -Sw holds the pacman lock, so it must be done before any
+    // transaction; flatpak has its own locking and can run throughout.
+    Prefetch repo_prefetch, flatpak_prefetch;
+    bool prefetched = false;
+    if (!g_dry_run) {
+        if (!pacman_pkgs.empty() && !aur_pkgs.empty()) {
+            // Authenticate in the foreground; the background sudo can't prompt.
+            ExecOptions visible;
+            visible.show_output = true;
+            if (exec_status({"sudo", "-v"}, visible) == 0) {
+                std::vector<std::string> targets;
+                for (const auto& pkg : pacman_pkgs) targets.push_back(sanitize_package(pkg));
+                if (g_config.download_mirrors > 0) {
+                    repo_prefetch.start([targets]() { download_packages(download_plan(targets), [](const std::string&) {}); });
                 } else {
-                    // Package not found in pacman or AUR, prompt for Flatpak search
-                    std::cout << YELLOW << "Package \"" << pkg << "\" not found on pacman or the AUR." << RESET << std::endl;
-                    if (confirm("Search on Flatpak?", true)) {
-                        if (check_flatpak()) {
-                            std::string flatpak_results = search_flatpak(pkg);
-                            if (!flatpak_results.empty() && flatpak_results.find("No matches") == std::string::npos &&
-                                flatpak_results.find("Application") == std::string::npos) {
-                                std::cout << CYAN << "Found on Flatpak:" << RESET << std::endl;
-                                std::cout << flatpak_results << std::endl;
-                                std::string flatpak_id = get_flatpak_package_id(pkg);
-                                if (!flatpak_id.empty() && confirm("Install from Flatpak? (package id: " + flatpak_id + ") [Y/n]", true)) {
-                                    flatpak_pkgs.push_back(flatpak_id);
-                                }
-                            } else {
-                                std::cout << RED << "Package \"" << pkg << "\" not found on Flatpak either." << RESET << std::endl;
-                                std::cout << "If the package is a .tar.gz file you want to install, run \"rinse <path/to/file>\"" << std::endl;
-                            }
-                        } else {
-                            std::cout << YELLOW << "Flatpak is not installed. Install it first with: rinse flatpak" << RESET << std::endl;
-                        }
-                    }
+                    std::vector<std::string> cmd = {"sudo", "pacman", "-Sw", "--noconfirm"};
+                    cmd.insert(cmd.end(), targets.begin(), targets.end());
+                    repo_prefetch.start({cmd});
                 }
+                prefetched = true;
             }
         }
+        if (!flatpak_pkgs.empty() && (!pacman_pkgs.empty() || !aur_pkgs.empty()) && have_flatpak) {
+            std::vector<std::vector<std::string>> cmds;
+            for (const auto& pkg : flatpak_pkgs) {
+                cmds.push_back({"flatpak", "install", "--no-deploy", "-y", "--noninteractive", pkg.first, pkg.second, "--system"});
+            }
+            flatpak_prefetch.start(cmds);
+        }
+    }
+
+    std::vector<AurBuild> aur_builds;
+    std::vector<std::string> aur_repo_deps;
+    bool aur_planned = false;
+    if (!aur_pkgs.empty()) {
+        TracePhase phase("aur plan");
+        std::cout << CYAN << "\nResolving AUR packages..." << RESET << std::endl;
+        aur_planned = aur_plan(aur_pkgs, aur_builds, aur_repo_deps);
+        ok &= aur_planned;
     }
 
+    repo_prefetch.wait();
     if (!pacman_pkgs.empty()) {
+        TracePhase phase("transaction: pacman");
         std::cout << CYAN << "\nInstalling from official repos..." << RESET << std::endl;
-        std::string cmd = "sudo pacman -S --noconfirm";
-        for (const auto& pkg : pacman_pkgs) cmd += " " + sanitize_package(pkg);
-        show_progress(cmd, "Installing");
+        std::vector<std::string> cmd = {"sudo", "pacman", "-S", "--noconfirm"};
+        for (const auto& pkg : pacman_pkgs) cmd.push_back(sanitize_package(pkg));
+        if (!prefetched) predownload(std::vector<std::string>(cmd.begin() + 4, cmd.end()));
+        ok &= show_progress(cmd, "Installing");
     }
 
-    if (!aur_pkgs.empty()) {
-        ensure_yay();
+    if (aur_planned) {
+        TracePhase phase("transaction: aur");
         std::cout << CYAN << "\nInstalling from AUR..." << RESET << std::endl;
-        std::string cmd = "yay -S --noconfirm";
-        for (const auto& pkg : aur_pkgs) cmd += " " + sanitize_package(pkg);
-        show_progress(cmd, "Installing");
+        ok &= aur_install(aur_pkgs, aur_builds, aur_repo_deps);
     }
 
+    flatpak_prefetch.wait();
     if (!flatpak_pkgs.empty()) {
-        if (!check_flatpak()) {
-            std::cout << YELLOW << "\nFlatpak is not installed. Installing flatpak first..." << RESET << std::endl;
-            if (confirm("Install flatpak?", true)) {
-                show_progress("sudo pacman -S --noconfirm flatpak", "Installing");
-            } else {
-                std::cout << RED << "Cannot install Flatpak packages without flatpak" << RESET << std::endl;
-                return;
-            }
-        }
+        TracePhase phase("transaction: flatpak");
         std::cout << CYAN << "\nInstalling from Flatpak..." << RESET << std::endl;
         for (const auto& pkg : flatpak_pkgs) {
-            std::string cmd = "flatpak install -y flathub " + sanitize_package(pkg) + " --system";
-            show_progress(cmd, "Installing");
+            ok &= show_progress({"flatpak", "install", "-y", pkg.first, pkg.second, "--system"}, "Installing");
         }
     }
 
-    if (!pacman_pkgs.empty() || !aur_pkgs.empty() || !flatpak_pkgs.empty()) {
+    if (!ok) {
+        std::cout << RED << "\n✗ Installation finished with errors" << RESET << std::endl;
+        send_notification("Package installation failed");
+    } else if (!pacman_pkgs.empty() || !aur_pkgs.empty() || !flatpak_pkgs.empty()) {
         std::cout << GREEN << "\n✓ Installation complete" << RESET << std::endl;
         send_notification("Package installation complete");
     }
 }
 
 void remove_package(const std::vector<std::string>& pkgs) {
+    bool ok = true;
     std::vector<std::string> to_remove;
     std::vector<std::string> flatpak_to_remove;
 
@@ -680,65 +4549,525 @@ void remove_package(const std::vector<std::string>& pkgs) {
             if (i < to_remove.size() - 1) pkg_list += ", ";
         }
 
-        if (!confirm("Remove package" + std::string(to_remove.size() > 1 ? "s" : "") + " \"" + pkg_list + "\"?", true)) return;
+        // Worked out from the local DB before asking anything: what the
+        // removal would break, and which dependencies -Rns would take along.
+        const DepGraph& graph = dep_graph();
+        std::vector<size_t> targets;
+        for (const auto& pkg : to_remove) {
+            long i = graph.index(sanitize_package(pkg));
+            if (i >= 0) targets.push_back(i);
+        }
+        std::vector<size_t> removal = graph.removal_set(targets, false);
+        auto breaks = graph.broken_by(removal);
+        if (!breaks.empty()) {
+            std::cout << RED << "Removing \"" << pkg_list << "\" would break:" << RESET << std::endl;
+            for (const auto& b : breaks) {
+                std::cout << "  " << graph.package(b.package).name << " (needs " << b.needs << ")" << std::endl;
+            }
+            std::cout << YELLOW << "Remove those as well, or keep \"" << pkg_list << "\"" << RESET << std::endl;
+            return;
+        }
+
+        uint64_t freed = 0;
+        for (size_t i : removal) freed += graph.package(i).size;
+        if (!confirm("Remove package" + std::string(to_remove.size() > 1 ? "s" : "") + " \"" + pkg_list + "\" (" +
+                     format_bytes(freed) + ")?", true)) {
+            return;
+        }
+
+        std::vector<size_t> with_deps = graph.removal_set(targets, true);
+        bool remove_orphans = false;
+        if (with_deps.size() > removal.size()) {
+            std::vector<std::string> names;
+            uint64_t dep_bytes = 0;
+            for (size_t k = removal.size(); k < with_deps.size(); k++) {
+                names.push_back(graph.package(with_deps[k]).name);
+                dep_bytes += graph.package(with_deps[k]).size;
+            }
+            std::sort(names.begin(), names.end());
+            std::cout << "Dependencies nothing else needs (" << format_bytes(dep_bytes) << "): " << join(names, " ") << std::endl;
+            remove_orphans = confirm("Remove them too?", true);
+        }
+
+        TracePhase phase("transaction: pacman");
+        std::vector<std::string> cmd = {"sudo", "pacman", remove_orphans ? "-Rns" : "-R", "--noconfirm"};
+        for (const auto& pkg : to_remove) cmd.push_back(sanitize_package(pkg));
+
+        ok &= show_progress(cmd, "Removing");
+    }
+
+    if (!flatpak_to_remove.empty()) {
+        TracePhase phase("transaction: flatpak");
+        std::cout << CYAN << "\nRemoving Flatpak apps..." << RESET << std::endl;
+        for (const auto& pkg : flatpak_to_remove) {
+            const FlatpakApp* app = flatpak_index().find(pkg);
+            ok &= show_progress({"flatpak", "uninstall", "-y", app && app->user ? "--user" : "--system", sanitize_package(pkg)}, "Removing");
+        }
+    }
+
+    if (!ok) {
+        std::cout << RED << "\n✗ Removal finished with errors" << RESET << std::endl;
+    } else if (!to_remove.empty() || !flatpak_to_remove.empty()) {
+        std::cout << GREEN << "\n✓ Removal complete" << RESET << std::endl;
+        send_notification("Package removal complete");
+    }
+}
+
+std::string get_version_file_path() {
+    return get_home() + "/.config/rinse/" + VERSION_FILE;
+}
+
+std::string get_current_version() {
+    std::string version_path = get_version_file_path();
+    if (fs::exists(version_path)) {
+        std::ifstream file(version_path);
+        std::string version;
+        std::getline(file, version);
+        return trim(version);
+    }
+    return "unknown";
+}
+
+void save_version(const std::string& version) {
+    std::string version_path = get_version_file_path();
+    fs::create_directories(get_home() + "/.config/rinse");
+    std::ofstream file(version_path);
+    file << version;
+}
+
+// `rinse update --check`: what an update would bring, without root and
+// without touching anything. Repo upgrades come from the sync DBs as they
+// are on disk; packages that aren't in any repo are looked up on the AUR in
+// one batched request. Exits 0 if there is something to update, 2 if not,
+// like checkupdates.
+int check_updates() {
+    std::vector<Upgrade> repo = upgradable();
+    std::vector<Upgrade> aur;
+
+    std::vector<std::string> foreign;
+    for (const auto& pkg : local_db().packages()) {
+        if (!sync_index().find(pkg.name)) foreign.push_back(pkg.name);
+    }
+    if (!foreign.empty() && !g_offline) {
+        TracePhase phase("aur fetch");
+        aur_prefetch(foreign);
+        for (const auto& name : foreign) {
+            const AurPackage* info = aur_lookup(name);
+            const LocalPackage* pkg = local_db().find(name);
+            if (info && pkg && vercmp(info->version, pkg->version) > 0) aur.push_back({name, "aur", pkg->version, info->version});
+        }
+    }
+
+    if (repo.empty() && aur.empty()) {
+        std::cout << GREEN << "Everything is up to date" << RESET << std::endl;
+        return 2;
+    }
+
+    size_t name_width = 7, from_width = 7;
+    for (const auto* list : {&repo, &aur}) {
+        for (const auto& u : *list) {
+            name_width = std::max(name_width, u.name.size());
+            from_width = std::max(from_width, u.from.size());
+        }
+    }
+    auto print = [&](const std::vector<Upgrade>& list, const std::string& title) {
+        if (list.empty()) return;
+        std::cout << BOLD << title << " (" << list.size() << ")" << RESET << std::endl;
+        for (const auto& u : list) {
+            std::cout << "  " << std::left << std::setw(name_width + 2) << u.name << std::setw(from_width) << u.from
+                      << " -> " << GREEN << u.to << RESET << std::endl;
+        }
+    };
+    print(repo, "Repo upgrades");
+    print(aur, "AUR upgrades");
+    if (!foreign.empty() && g_offline) {
+        std::cout << YELLOW << foreign.size() << " AUR/foreign packages not checked (--offline)" << RESET << std::endl;
+    }
+    return 0;
+}
+
+// `rinse checkupdates`: fresh sync DBs without root and without touching
+// pacman's own. Every repo's .db is fetched at once into
+// ~/.cache/rinse/db/sync, trying its mirrors in order, and If-Modified-Since
+// (curl -z) makes an unchanged repo cost one round trip. That dbpath gets
+// a link to the real local DB, and the report is the one from
+// `update --check`.
+int checkupdates() {
+    std::string root = get_cache_dir() + "/db";
+    std::vector<PacmanRepo> repos = pacman_repos(g_config.pacman_conf);
+    if (repos.empty()) {
+        std::cerr << RED << "No repos found in " << g_config.pacman_conf << RESET << std::endl;
+        return 1;
+    }
+
+    std::error_code ec;
+    fs::create_directories(root + "/sync", ec);
+    std::string local = fs::absolute(g_dbpath + "/local", ec).string();
+    if (fs::read_symlink(root + "/local", ec) != local) {
+        fs::remove(root + "/local", ec);
+        fs::create_directory_symlink(local, root + "/local", ec);
+    }
+    // DBs of repos that have since left pacman.conf would still be indexed.
+    for (const auto& entry : fs::directory_iterator(root + "/sync", ec)) {
+        std::string repo = entry.path().stem().string();
+        if (std::none_of(repos.begin(), repos.end(), [&](const PacmanRepo& r) { return r.name == repo; })) {
+            fs::remove(entry.path(), ec);
+        }
+    }
+
+    enum { Failed, Unchanged, Fetched };
+    std::vector<int> results(repos.size(), Failed);
+    if (!g_offline) {
+        TracePhase phase("sync refresh");
+        std::cout << CYAN << "Syncing " << repos.size() << " repos into " << root << "..." << RESET << std::endl;
+        parallel_for(repos.size(), [&](size_t i) {
+            std::string path = root + "/sync/" + repos[i].name + ".db";
+            std::string part = path + ".part";
+            for (const auto& server : repos[i].servers) {
+                std::error_code fs_ec;
+                fs::remove(part, fs_ec);
+                std::vector<std::string> cmd = {"curl", "-sL", "--fail", "--connect-timeout", "10", "-R", "-w", "%{http_code}", "-o", part};
+                if (fs::exists(path, fs_ec)) {
+                    cmd.push_back("-z");
+                    cmd.push_back(path);
+                }
+                cmd.push_back(server + "/" + repos[i].name + ".db");
+                std::string code;
+                if (exec_lines(cmd, [&](const std::string& line) { code += line; }) != 0) continue;
+                // A 304 (or a file:// mirror that isn't newer) leaves nothing behind.
+                if (code == "304" || !fs::exists(part, fs_ec)) {
+                    results[i] = Unchanged;
+                } else {
+                    fs::rename(part, path, fs_ec);
+                    results[i] = fs_ec ? Failed : Fetched;
+                }
+                if (results[i] != Failed) break;
+            }
+            std::error_code fs_ec;
+            fs::remove(part, fs_ec);
+        });
+
+        size_t fetched = std::count(results.begin(), results.end(), Fetched);
+        size_t unchanged = std::count(results.begin(), results.end(), Unchanged);
+        std::cout << "Synced " << fetched + unchanged << "/" << repos.size() << " repos (" << fetched << " updated, "
+                  << unchanged << " unchanged)" << std::endl;
+        for (size_t i = 0; i < repos.size(); i++) {
+            if (results[i] != Failed) continue;
+            bool stale = fs::exists(root + "/sync/" + repos[i].name + ".db", ec);
+            std::cout << RED << "Could not fetch " << repos[i].name << " from any of its " << repos[i].servers.size()
+                      << " mirror" << (repos[i].servers.size() == 1 ? "" : "s") << (stale ? "; using the last copy" : "") << RESET << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    g_sync_index = std::make_unique<SyncIndex>();
+    if (!g_sync_index->open(root + "/sync", get_cache_dir() + "/checkupdates.idx")) {
+        std::cerr << RED << "No sync databases in " << root << "/sync" << RESET << std::endl;
+        return 1;
+    }
+    g_upgradable.reset();
+    return check_updates();
+}
+
+// `rinse mirrors`: ranks the mirrorlist by probing every mirror at once. Each
+// probe reads the mirror's lastsync stamp and times a download of the first
+// repo's .db as the sample, with curl timeouts so a dead mirror costs
+// seconds, not minutes. Mirrors that answer are ranked fastest first, with
+// those lagging the freshest mirror behind the rest, and the ones that don't
+// are kept but commented out. The list is replaced with a rename, after a
+// copy of the old one is saved next to it as .bak.
+const int MIRROR_PROBE_WORKERS = 16;
+const char* MIRROR_CONNECT_TIMEOUT = "3";
+const char* MIRROR_MAX_TIME = "10";
+const time_t MIRROR_MAX_LAG = 6 * 3600;
+
+struct MirrorProbe {
+    std::string server;    // as written, with $repo and $arch
+    bool reachable = false;
+    double latency = 0;    // seconds to the first byte of the sample
+    double seconds = 0;    // for the whole sample
+    double speed = 0;      // bytes per second
+    time_t lastsync = 0;   // 0 if the mirror doesn't publish one
+};
+
+void probe_mirror(MirrorProbe& probe, const std::string& repo, const std::string& arch) {
+    std::string url = probe.server;
+    for (auto [var, val] : {std::pair<std::string, std::string>{"$repo", repo}, {"$arch", arch}}) {
+        for (size_t at; (at = url.find(var)) != std::string::npos;) url.replace(at, var.size(), val);
+    }
+    std::string out;
+    int status = exec_lines({"curl", "-sL", "--fail", "--connect-timeout", MIRROR_CONNECT_TIMEOUT, "-m", MIRROR_MAX_TIME,
+                             "-o", "/dev/null", "-w", "%{time_starttransfer} %{time_total} %{speed_download}",
+                             url + "/" + repo + ".db"},
+                            [&](const std::string& line) { out += line; });
+    std::istringstream in(out);
+    probe.reachable = status == 0 && in >> probe.latency >> probe.seconds >> probe.speed;
+    if (!probe.reachable) return;
+
+    // Arch-style mirrors keep a unix timestamp of their last sync at the root.
+    size_t at = probe.server.find("$repo");
+    if (at == std::string::npos) return;
+    std::string stamp = exec({"curl", "-sL", "--fail", "--connect-timeout", MIRROR_CONNECT_TIMEOUT, "-m", MIRROR_MAX_TIME,
+                              probe.server.substr(0, at) + "lastsync"});
+    char* end = nullptr;
+    long long value = std::strtoll(stamp.c_str(), &end, 10);
+    if (end != stamp.c_str() && trim(end).empty()) probe.lastsync = value;
+}
+
+// Replaces path with content by a rename, keeping the old file as path.bak.
+// Through sudo when the directory isn't writable.
+bool replace_file(const std::string& path, const std::string& content) {
+    std::string dir = fs::path(path).parent_path().string();
+    bool direct = access((dir.empty() ? "." : dir).c_str(), W_OK) == 0;
+    std::string tmp = direct ? path + ".rinse-tmp" : get_cache_dir() + "/" + fs::path(path).filename().string();
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        file << content;
+        if (!file.flush()) return false;
+    }
+
+    std::error_code ec;
+    if (direct) {
+        fs::copy_file(path, path + ".bak", fs::copy_options::overwrite_existing, ec);
+        if (!ec) fs::rename(tmp, path, ec);
+        if (ec) fs::remove(tmp, ec);
+        return !ec;
+    }
+    bool ok = exec_status({"sudo", "cp", "-p", "--", path, path + ".bak"}) == 0 &&
+              exec_status({"sudo", "install", "-m", "644", "-T", "--", tmp, path + ".rinse-tmp"}) == 0 &&
+              exec_status({"sudo", "mv", "-f", "--", path + ".rinse-tmp", path}) == 0;
+    fs::remove(tmp, ec);
+    return ok;
+}
+
+int rank_mirrors(std::string path) {
+    std::vector<PacmanRepo> repos = pacman_repos(g_config.pacman_conf);
+    if (repos.empty()) {
+        std::cerr << RED << "No repos found in " << g_config.pacman_conf << RESET << std::endl;
+        return 1;
+    }
+    // The sample comes from the first repo that reads this mirrorlist.
+    const PacmanRepo* sample = nullptr;
+    for (const auto& repo : repos) {
+        if (!repo.includes.empty() && (path.empty() || std::count(repo.includes.begin(), repo.includes.end(), path))) {
+            sample = &repo;
+            break;
+        }
+    }
+    if (path.empty()) {
+        if (!sample) {
+            std::cerr << RED << "No mirrorlist is Include'd in " << g_config.pacman_conf << ", pass one: rinse mirrors <file>" << RESET << std::endl;
+            return 1;
+        }
+        path = sample->includes.front();
+    }
+    if (!sample) sample = &repos.front();
+
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << RED << "Could not read " << path << RESET << std::endl;
+        return 1;
+    }
+    // Only the enabled servers compete, like rankmirrors. A list with none,
+    // such as the stock one, has all of its commented-out servers tried.
+    std::vector<MirrorProbe> enabled, disabled;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string entry = trim(line);
+        bool commented = !entry.empty() && entry[0] == '#';
+        if (commented) entry = trim(entry.substr(std::min(entry.size(), entry.find_first_not_of('#'))));
+        size_t eq = entry.find('=');
+        if (eq == std::string::npos || trim(entry.substr(0, eq)) != "Server") continue;
+        MirrorProbe probe;
+        probe.server = trim(entry.substr(eq + 1).substr(0, entry.substr(eq + 1).find('#')));
+        (commented ? disabled : enabled).push_back(probe);
+    }
+    std::vector<MirrorProbe>& probes = enabled.empty() ? disabled : enabled;
+    if (probes.empty()) {
+        std::cerr << RED << "No Server lines in " << path << RESET << std::endl;
+        return 1;
+    }
+    if (g_offline) {
+        std::cerr << RED << "Mirrors can't be ranked with --offline" << RESET << std::endl;
+        return 1;
+    }
+
+    std::cout << CYAN << "Probing " << probes.size() << " mirror" << (probes.size() == 1 ? "" : "s") << " from " << path
+              << " with " << sample->name << ".db..." << RESET << std::endl;
+    {
+        TracePhase phase("mirror probes");
+        parallel_for(probes.size(), [&](size_t i) { probe_mirror(probes[i], sample->name, sample->arch); }, MIRROR_PROBE_WORKERS);
+    }
+
+    time_t freshest = 0;
+    for (const auto& probe : probes) {
+        if (probe.reachable) freshest = std::max(freshest, probe.lastsync);
+    }
+    auto lagging = [&](const MirrorProbe& probe) { return probe.lastsync && probe.lastsync + MIRROR_MAX_LAG < freshest; };
+    std::stable_sort(probes.begin(), probes.end(), [&](const MirrorProbe& a, const MirrorProbe& b) {
+        if (a.reachable != b.reachable) return a.reachable;
+        if (lagging(a) != lagging(b)) return !lagging(a);
+        return a.seconds < b.seconds;
+    });
+
+    size_t reachable = std::count_if(probes.begin(), probes.end(), [](const MirrorProbe& p) { return p.reachable; });
+    size_t server_width = 6;
+    for (const auto& probe : probes) server_width = std::max(server_width, probe.server.size());
+    std::cout << BOLD << "\n  " << std::left << std::setw(4) << "#" << std::setw(server_width + 2) << "Mirror" << std::setw(10)
+              << "Latency" << std::setw(13) << "Speed" << "Last sync" << RESET << std::endl;
+    for (size_t i = 0; i < probes.size(); i++) {
+        const MirrorProbe& p = probes[i];
+        std::cout << "  " << std::left << std::setw(4) << (p.reachable ? std::to_string(i + 1) : "-") << std::setw(server_width + 2) << p.server;
+        if (!p.reachable) {
+            std::cout << RED << "unreachable" << RESET << std::endl;
+            continue;
+        }
+        char latency[16];
+        snprintf(latency, sizeof(latency), "%.0f ms", p.latency * 1000);
+        std::cout << std::setw(10) << latency << std::setw(13) << format_bytes(p.speed) + "/s";
+        if (!p.lastsync) std::cout << "-";
+        else std::cout << (lagging(p) ? YELLOW : "") << format_age(std::max<time_t>(0, time(nullptr) - p.lastsync)) << " ago" << RESET;
+        std::cout << std::endl;
+    }
+    std::cout << std::endl;
+
+    if (reachable == 0) {
+        std::cout << RED << "No mirror answered, " << path << " was left alone" << RESET << std::endl;
+        return 1;
+    }
+
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&now));
+    std::ostringstream out;
+    out << "# Ranked by rinse mirrors on " << date << ", fastest first.\n";
+    out << "# Mirrors more than " << MIRROR_MAX_LAG / 3600 << " hours behind the freshest come last; the previous list is "
+        << fs::path(path).filename().string() << ".bak\n\n";
+    for (const auto& probe : probes) {
+        if (probe.reachable) out << "Server = " << probe.server << "\n";
+    }
+    if (reachable < probes.size()) {
+        out << "\n# Unreachable when ranked\n";
+        for (const auto& probe : probes) {
+            if (!probe.reachable) out << "#Server = " << probe.server << "\n";
+        }
+    }
+    std::vector<MirrorProbe>& others = &probes == &enabled ? disabled : enabled;
+    if (!others.empty()) {
+        out << "\n# Not ranked\n";
+        for (const auto& probe : others) out << "#Server = " << probe.server << "\n";
+    }
+
+    if (g_dry_run) {
+        std::cout << YELLOW << "[DRY RUN] Would write " << reachable << " ranked mirrors to " << path << RESET << std::endl;
+        return 0;
+    }
+    if (!confirm("Write the ranked list to " + path + "?", true)) return 0;
+    if (!replace_file(path, out.str())) {
+        std::cout << RED << "Could not write " << path << RESET << std::endl;
+        return 1;
+    }
+    std::cout << GREEN << "✓ Wrote " << reachable << " ranked mirrors to " << path << " (previous list in " << path << ".bak)" << RESET << std::endl;
+    return 0;
+}
 
-        std::string orphans = exec("pacman -Qtdq 2>/dev/null");
-        bool remove_orphans = false;
+// `rinse update` as a pipeline: the repo sync and package downloads, the
+// repo transaction, then the AUR upgrade as soon as it has committed, while
+// Flatpak updates run alongside all of them (flatpak doesn't take pacman's
+// lock). Wall time is roughly the longest chain instead of the sum of all.
+bool update_system() {
+    if (!confirm("Update system?", true)) return false;
+
+    std::vector<Stage> stages(4);
+    Stage& download = stages[0];
+    Stage& repos = stages[1];
+    Stage& aur = stages[2];
+    Stage& flatpak = stages[3];
+    download.name = "download";
+    download.trace_name = "update: download";
+    repos.name = "repos";
+    repos.trace_name = "update: repos";
+    repos.cmd = {"sudo", "pacman", "-Syu", "--noconfirm"};
+    aur.name = "AUR";
+    aur.trace_name = "update: aur";
+    aur.cmd = {"yay", "-Sua", "--noconfirm"};
+    aur.note = "repos";
+    flatpak.name = "Flatpak";
+    flatpak.trace_name = "update: flatpak";
+    flatpak.cmd = {"flatpak", "update", "-y", "--noninteractive"};
 
-        if (!orphans.empty()) {
-            remove_orphans = confirm("Remove orphan dependencies?", true);
+    if (g_dry_run) {
+        for (const auto& stage : stages) {
+            if (stage.cmd.empty()) continue;
+            std::cout << YELLOW << "[DRY RUN] Would execute: " << RESET << join_command(stage.cmd) << "\n";
         }
+        return true;
+    }
 
-        std::string cmd = "sudo pacman -R";
-        if (remove_orphans) cmd += "ns";
-        cmd += " --noconfirm";
-        for (const auto& pkg : to_remove) cmd += " " + sanitize_package(pkg);
-
-        show_progress(cmd, "Removing");
+    // Authenticate once up front; the stages then run without a prompt.
+    ExecOptions visible;
+    visible.show_output = true;
+    if (exec_status({"sudo", "-v"}, visible) != 0) {
+        std::cout << RED << "Could not get sudo rights, nothing was updated" << RESET << std::endl;
+        return false;
     }
 
-    if (!flatpak_to_remove.empty()) {
-        std::cout << CYAN << "\nRemoving Flatpak apps..." << RESET << std::endl;
-        for (const auto& pkg : flatpak_to_remove) {
-            std::string cmd = "flatpak uninstall -y " + sanitize_package(pkg);
-            show_progress(cmd, "Removing");
-        }
+    std::cout << CYAN << "Updating system..." << RESET << std::endl;
+    StageBoard board(stages);
+    bool have_yay = check_command("yay");
+    bool have_flatpak = check_flatpak();
+    if (!have_yay) board.skip(aur, "yay is not installed");
+    if (!have_flatpak) board.skip(flatpak, "flatpak is not installed");
+    if (g_config.download_mirrors > 0) repos.note = "download";
+    else board.skip(download, "download_mirrors = 0");
+    board.draw();
+
+    std::thread flatpak_thread;
+    if (have_flatpak) flatpak_thread = std::thread([&]() { board.run(flatpak); });
+
+    // Once the databases are synced here, the transaction only has to -Su,
+    // and finds what it needs already in the cache. If the sync fails the
+    // transaction does it itself, and failed downloads pacman fetches.
+    if (g_config.download_mirrors > 0) {
+        bool synced = false;
+        bool ok = board.run(download, [&](const std::function<void(const std::string&)>& emit) {
+            int code = exec_stream({"sudo", "pacman", "-Sy", "--noconfirm"}, [&](const std::string& line, bool) { emit(line); }, [] {}, 1000);
+            if (code != 0) return code;
+            synced = true;
+            return download_packages(download_plan({"-u"}), emit) ? 0 : 1;
+        });
+        if (!ok) board.skip(download, synced ? "pacman downloads the rest" : "sync failed");
+        if (synced) repos.cmd[2] = "-Su";
     }
 
-    if (!to_remove.empty() || !flatpak_to_remove.empty()) {
-        std::cout << GREEN << "\n✓ Removal complete" << RESET << std::endl;
-        send_notification("Package removal complete");
+    if (board.run(repos)) {
+        if (have_yay) board.run(aur);
+    } else if (have_yay) {
+        board.skip(aur, "repo update failed");
     }
-}
 
-std::string get_version_file_path() {
-    return get_home() + "/.config/rinse/" + VERSION_FILE;
-}
+    if (flatpak_thread.joinable()) flatpak_thread.join();
 
-std::string get_current_version() {
-    std::string version_path = get_version_file_path();
-    if (fs::exists(version_path)) {
-        std::ifstream file(version_path);
-        std::string version;
-        std::getline(file, version);
-        return trim(version);
+    std::string failure_log;
+    for (const auto& stage : stages) {
+        if (stage.state != Stage::State::Failed) continue;
+        std::cout << RED << "\n" << stage.name << " update failed (exit code " << stage.exit_code << "). Output:" << RESET << std::endl;
+        if (!g_full_log) std::cout << stage.log;
+        failure_log += "$ " + join_command(stage.cmd) + "\n" + stage.log + "\n";
     }
-    return "unknown";
-}
 
-void save_version(const std::string& version) {
-    std::string version_path = get_version_file_path();
-    fs::create_directories(get_home() + "/.config/rinse");
-    std::ofstream file(version_path);
-    file << version;
-}
+    if (!failure_log.empty()) {
+        std::string log_path = get_cache_dir() + "/last-failure.log";
+        save_failure_log(failure_log, log_path);
+        std::cout << YELLOW << "Full log saved to " << log_path << RESET << std::endl;
+        std::cout << RED << "\n✗ Update finished with errors" << RESET << std::endl;
+        send_notification("System update failed");
+        return false;
+    }
 
-void update_system() {
-    if (!confirm("Update system? (This function is currently under major rebuilding, for now, it just updates directly.)", true)) { return; }
-    std::cout << BOLD << YELLOW << "System is updating. Please be patient. \n";
-    exec("sudo pacman --noconfirm -Syu");
-    exec("yay --noconfirm -Syu");
-    exec("flatpak update");
+    std::cout << GREEN << "\n✓ Update complete" << RESET << std::endl;
+    send_notification("System update complete");
+    return true;
 }
 
 void update_rinse() {
@@ -752,7 +5081,7 @@ void update_rinse() {
     std::string current_version = get_current_version();
 
     std::string api_url = "https://api.github.com/repos/Rousevv/rinse/releases/latest";
-    std::string release_info = exec("curl -s " + api_url);
+    std::string release_info = exec({"curl", "-s", api_url});
     
     if (release_info.empty()) {
         std::cout << YELLOW << "Could not check for updates (network error)" << RESET << std::endl;
@@ -789,9 +5118,11 @@ void update_rinse() {
         download_url = "https://github.com/Rousevv/rinse/raw/" + branch + "/rinse";
     }
     
-    exec("curl -L -o /tmp/rinse https://github.com/Rousevv/rinse/releases/latest/download/rinse");    
+    exec_status({"curl", "-L", "-o", "/tmp/rinse", "https://github.com/Rousevv/rinse/releases/latest/download/rinse"});
 
-    exec("chmod +x /tmp/rinse");
+    std::error_code ec;
+    fs::permissions("/tmp/rinse", fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec,
+                    fs::perm_options::add, ec);
     
     std::string update_script = "/tmp/rinse_updater.sh";
     std::ofstream script(update_script);
@@ -803,37 +5134,40 @@ void update_rinse() {
     script << "echo '" << latest_version << "' > " << get_version_file_path() << "\n";
     script.close();
     
-    exec_status(("chmod +x " + update_script).c_str());
-    
-    system((update_script + " &").c_str());
+    fs::permissions(update_script, fs::perms::owner_exec, fs::perm_options::add, ec);
+
+    exec_background({update_script});
     exit(0);
 }
 
 void lookup_packages(const std::vector<std::string>& search_terms = {}) {
+    const auto& installed = local_db().packages();
+
     if (search_terms.empty()) {
-        std::string result = exec("pacman -Q");
-        if (result.empty()) {
+        if (installed.empty()) {
             std::cout << YELLOW << "No packages installed" << RESET << std::endl;
         } else {
-            std::cout << result;
+            for (const auto& pkg : installed) {
+                std::cout << pkg.name << " " << pkg.version << "\n";
+            }
+            std::cout << std::flush;
         }
     } else {
         std::vector<std::string> found;
-        std::string all_pkgs = exec("pacman -Q");
-        std::istringstream iss(all_pkgs);
-        std::string line;
-
-        while (std::getline(iss, line)) {
-            std::string pkg_name = line.substr(0, line.find(' '));
+        std::vector<std::string> lower_terms;
+        for (const auto& term : search_terms) {
+            std::string lower_term = term;
+            std::transform(lower_term.begin(), lower_term.end(), lower_term.begin(), ::tolower);
+            lower_terms.push_back(lower_term);
+        }
 
-            for (const auto& term : search_terms) {
-                std::string lower_pkg = pkg_name;
-                std::string lower_term = term;
-                std::transform(lower_pkg.begin(), lower_pkg.end(), lower_pkg.begin(), ::tolower);
-                std::transform(lower_term.begin(), lower_term.end(), lower_term.begin(), ::tolower);
+        for (const auto& pkg : installed) {
+            std::string lower_pkg = pkg.name;
+            std::transform(lower_pkg.begin(), lower_pkg.end(), lower_pkg.begin(), ::tolower);
 
+            for (const auto& lower_term : lower_terms) {
                 if (lower_pkg.find(lower_term) != std::string::npos) {
-                    found.push_back(line);
+                    found.push_back(pkg.name + " " + pkg.version);
                     break;
                 }
             }
@@ -856,21 +5190,236 @@ void lookup_packages(const std::vector<std::string>& search_terms = {}) {
     }
 }
 
+// One package file found by the cache scan.
+struct CacheFile {
+    size_t root = 0;
+    std::string path;
+    PackageFileName pkg;
+    bool has_sig = false;
+    uint64_t size = 0;          // including the detached .sig
+    bool remove = false;
+    bool stray_sig = false;     // path is a .sig whose package is gone
+};
+
+struct CacheRoot {
+    std::string dir;
+    bool nested = false;        // package files sit one directory down
+    bool drop_uninstalled = false;
+};
+
+// Package caches rinse cleans: pacman's, and its own AUR build outputs.
+std::vector<CacheRoot> package_cache_roots() {
+    return {{"/var/cache/pacman/pkg", false, true}, {build_cache_dir(), true, false}, {aur_build_dir(), true, false}};
+}
+
+// Lists package files under every root, then stats them on a worker pool;
+// on a cache of tens of thousands of files the stats are what cost.
+std::vector<CacheFile> scan_package_caches(const std::vector<CacheRoot>& roots) {
+    std::vector<CacheFile> files;
+    std::map<std::string, size_t> sigs;     // path -> root
+    for (size_t r = 0; r < roots.size(); r++) {
+        std::vector<std::string> dirs;
+        std::error_code ec;
+        if (roots[r].nested) {
+            for (const auto& entry : fs::directory_iterator(roots[r].dir, ec)) {
+                if (entry.is_directory(ec)) dirs.push_back(entry.path().string());
+            }
+        } else {
+            dirs.push_back(roots[r].dir);
+        }
+        for (const auto& dir : dirs) {
+            for (const auto& entry : fs::directory_iterator(dir, ec)) {
+                std::string name = entry.path().filename().string();
+                if (name.size() > 4 && name.compare(name.size() - 4, 4, ".sig") == 0) {
+                    sigs.emplace(entry.path().string(), r);
+                    continue;
+                }
+                CacheFile file;
+                if (!parse_package_file_name(name, file.pkg)) continue;
+                file.root = r;
+                file.path = entry.path().string();
+                files.push_back(std::move(file));
+            }
+        }
+    }
+
+    // A signature left behind by a package someone deleted by hand is
+    // always removable; it's listed under the package it was signing.
+    std::set<std::string> packages;
+    for (const auto& file : files) packages.insert(file.path);
+    for (const auto& [sig, root] : sigs) {
+        std::string path = sig.substr(0, sig.size() - 4);
+        CacheFile file;
+        if (packages.count(path) || !parse_package_file_name(fs::path(path).filename().string(), file.pkg)) continue;
+        file.root = root;
+        file.path = sig;
+        file.stray_sig = true;
+        file.remove = true;
+        files.push_back(std::move(file));
+    }
+
+    parallel_for(files.size(), [&](size_t i) {
+        CacheFile& file = files[i];
+        file.has_sig = sigs.count(file.path + ".sig") > 0;
+        struct stat st;
+        if (lstat(file.path.c_str(), &st) == 0) file.size += st.st_size;
+        if (file.has_sig && lstat((file.path + ".sig").c_str(), &st) == 0) file.size += st.st_size;
+    }, 16);
+    return files;
+}
+
+// Marks what keep_versions lets go: per package (and cache), everything
+// but the newest keep_versions versions and the installed one. pacman's
+// cache also drops packages that are no longer installed, as pacman -Sc
+// did; the AUR caches keep them, since a shared build cache holds builds
+// for other machines too.
+void apply_retention(std::vector<CacheFile>& files, const std::vector<CacheRoot>& roots) {
+    std::map<std::tuple<size_t, std::string, std::string>, std::vector<CacheFile*>> groups;
+    for (auto& file : files) {
+        if (!file.stray_sig) groups[{file.root, file.pkg.name, file.pkg.arch}].push_back(&file);
+    }
+
+    for (auto& [key, group] : groups) {
+        const LocalPackage* installed = local_db().find(group.front()->pkg.name);
+        std::sort(group.begin(), group.end(), [](const CacheFile* a, const CacheFile* b) {
+            return vercmp(a->pkg.version, b->pkg.version) > 0;
+        });
+
+        int kept = 0;
+        const std::string* last = nullptr;
+        for (CacheFile* file : group) {
+            bool is_installed = installed && vercmp(file->pkg.version, installed->version) == 0;
+            if (!last || vercmp(*last, file->pkg.version) != 0) {
+                kept++;
+                last = &file->pkg.version;
+            }
+            if (is_installed) continue;
+            file->remove = (roots[file->root].drop_uninstalled && !installed) || kept > g_config.keep_versions;
+        }
+    }
+}
+
+// Deletes the given files (and signatures): directly where we can write,
+// through sudo rm in batches where we can't. Emptied build cache entries go too.
+bool remove_cache_files(const std::vector<const CacheFile*>& files, const std::vector<CacheRoot>& roots) {
+    bool ok = true;
+    std::vector<std::string> privileged;
+    std::set<std::string> parents;
+    for (const CacheFile* file : files) {
+        std::vector<std::string> paths = {file->path};
+        if (file->has_sig) paths.push_back(file->path + ".sig");
+        if (access(roots[file->root].dir.c_str(), W_OK) != 0) {
+            privileged.insert(privileged.end(), paths.begin(), paths.end());
+            continue;
+        }
+        for (const auto& path : paths) {
+            std::error_code ec;
+            if (!fs::remove(path, ec) && ec) ok = false;
+        }
+        if (roots[file->root].nested) parents.insert(fs::path(file->path).parent_path().string());
+    }
+
+    for (const auto& dir : parents) {
+        std::error_code ec;
+        if (fs::is_empty(dir, ec)) fs::remove(dir, ec);
+    }
+
+    const size_t batch = 512;
+    for (size_t i = 0; i < privileged.size(); i += batch) {
+        std::vector<std::string> cmd = {"sudo", "rm", "-f", "--"};
+        cmd.insert(cmd.end(), privileged.begin() + i, privileged.begin() + std::min(privileged.size(), i + batch));
+        ExecOptions visible;
+        visible.show_output = true;
+        ok &= exec_status(cmd, visible) == 0;
+    }
+    return ok;
+}
+
 void clean_cache() {
-    std::cout << CYAN << "Cleaning package cache..." << RESET << std::endl;
-    show_progress("sudo pacman -Sc --noconfirm", "Cleaning");
+    std::cout << CYAN << "Scanning package caches..." << RESET << std::endl;
+    auto scan_start = std::chrono::steady_clock::now();
+    std::vector<CacheRoot> roots = package_cache_roots();
+    std::vector<CacheFile> files;
+    {
+        TracePhase phase("cache scan");
+        files = scan_package_caches(roots);
+        apply_retention(files, roots);
+    }
+    double scan_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - scan_start).count();
+
+    uint64_t total = 0, reclaimable = 0;
+    std::map<std::string, std::pair<size_t, uint64_t>> by_package;    // name -> files, bytes
+    std::vector<const CacheFile*> doomed;
+    for (const auto& file : files) {
+        total += file.size;
+        if (!file.remove) continue;
+        reclaimable += file.size;
+        auto& entry = by_package[file.pkg.name];
+        entry.first++;
+        entry.second += file.size;
+        doomed.push_back(&file);
+    }
+
+    char secs[16];
+    snprintf(secs, sizeof(secs), "%.2f", scan_secs);
+    std::cout << "Scanned " << files.size() << " package files (" << format_bytes(total) << ") in " << secs << "s, keeping "
+              << g_config.keep_versions << " version" << (g_config.keep_versions == 1 ? "" : "s") << " per package" << std::endl;
+
+    if (doomed.empty()) {
+        std::cout << GREEN << "Nothing to remove from the package caches" << RESET << std::endl;
+    } else {
+        std::vector<std::pair<std::string, std::pair<size_t, uint64_t>>> ranked(by_package.begin(), by_package.end());
+        std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.second.second > b.second.second; });
+        size_t name_width = 7;
+        for (const auto& [name, stats] : ranked) name_width = std::max(name_width, name.size());
+
+        const size_t shown = 20;
+        std::cout << BOLD << "\n  " << std::left << std::setw(name_width + 2) << "Package" << std::setw(8) << "Files" << "Reclaimable" << RESET << std::endl;
+        for (size_t i = 0; i < ranked.size() && i < shown; i++) {
+            std::cout << "  " << std::left << std::setw(name_width + 2) << ranked[i].first << std::setw(8) << ranked[i].second.first
+                      << format_bytes(ranked[i].second.second) << std::endl;
+        }
+        if (ranked.size() > shown) std::cout << "  ... and " << ranked.size() - shown << " more packages" << std::endl;
+        std::cout << BOLD << "\nReclaimable: " << format_bytes(reclaimable) << " in " << doomed.size() << " file"
+                  << (doomed.size() == 1 ? "" : "s") << RESET << std::endl;
+
+        if (g_dry_run) {
+            std::cout << YELLOW << "[DRY RUN] Would remove " << doomed.size() << " package files" << RESET << std::endl;
+        } else if (confirm("Remove them?", true)) {
+            TracePhase phase("cache remove");
+            if (remove_cache_files(doomed, roots)) {
+                std::cout << GREEN << "Removed " << format_bytes(reclaimable) << RESET << std::endl;
+            } else {
+                std::cout << RED << "Some package files could not be removed" << RESET << std::endl;
+            }
+        }
+    }
 
     if (check_command("yay")) {
-        std::cout << CYAN << "Cleaning AUR cache..." << RESET << std::endl;
-        show_progress("yay -Sc --noconfirm", "Cleaning");
+        std::cout << CYAN << "Cleaning yay cache..." << RESET << std::endl;
+        show_progress({"yay", "-Sc", "--noconfirm"}, "Cleaning");
     }
 
-    std::string orphans = exec("pacman -Qtdq 2>/dev/null");
-    if (!orphans.empty() && confirm("Remove orphan packages?", true)) {
-        std::cout << CYAN << "Removing orphan packages..." << RESET << std::endl;
-        show_progress("sudo pacman -Rns $(pacman -Qtdq) --noconfirm 2>/dev/null", "Removing");
-    } else if (orphans.empty()) {
+    // Orphans plus whatever only they were holding on to, as -Rns would take.
+    const DepGraph& graph = dep_graph();
+    std::vector<size_t> orphans = graph.removal_set(graph.orphans(), true);
+    if (orphans.empty()) {
         std::cout << GREEN << "No orphan packages found" << RESET << std::endl;
+    } else {
+        std::vector<std::string> names;
+        uint64_t freed = 0;
+        for (size_t i : orphans) {
+            names.push_back(graph.package(i).name);
+            freed += graph.package(i).size;
+        }
+        std::sort(names.begin(), names.end());
+        std::cout << "\nOrphan packages (" << format_bytes(freed) << "): " << join(names, " ") << std::endl;
+        if (confirm("Remove " + std::to_string(names.size()) + " orphan package" + (names.size() == 1 ? "" : "s") + "?", true)) {
+            std::cout << CYAN << "Removing orphan packages..." << RESET << std::endl;
+            std::vector<std::string> cmd = {"sudo", "pacman", "-Rns", "--noconfirm"};
+            cmd.insert(cmd.end(), names.begin(), names.end());
+            show_progress(cmd, "Removing");
+        }
     }
 
     std::cout << GREEN << "\n✓ Cache cleanup complete" << RESET << std::endl;
@@ -888,8 +5437,9 @@ void install_file(const std::string& filepath) {
     if (!confirm("Installing from " + abs_path, true)) return;
 
     if (path.extension() == ".zst" || path.string().find(".pkg.tar") != std::string::npos) {
-        show_progress("sudo pacman -U " + sanitize_path(abs_path), "Installing");
-        std::cout << GREEN << "✓ Installation complete" << RESET << std::endl;
+        if (show_progress({"sudo", "pacman", "-U", abs_path}, "Installing")) {
+            std::cout << GREEN << "✓ Installation complete" << RESET << std::endl;
+        }
     } else if (path.extension() == ".gz" && path.string().find(".tar.gz") != std::string::npos) {
         std::string name = sanitize_path(path.stem().stem().string());
         std::string temp_dir = "/tmp/rinse-build-" + name;
@@ -901,30 +5451,47 @@ void install_file(const std::string& filepath) {
 
         std::cout << CYAN << "Extracting source archive..." << RESET << std::endl;
 
-        if (exec_status(("mkdir -p " + sanitize_path(temp_dir) + " && tar -xzf " + sanitize_path(abs_path) + " -C " + sanitize_path(temp_dir)).c_str()) != 0) {
+        std::error_code ec;
+        fs::create_directories(temp_dir, ec);
+        if (ec || exec_status({"tar", "-xzf", abs_path, "-C", temp_dir}) != 0) {
             std::cerr << RED << "✗ Failed to extract archive" << RESET << std::endl;
             return;
         }
 
+        // Tarballs usually wrap everything in one top-level directory
         std::string source_dir = temp_dir;
-        std::string found_dir = trim(exec("find " + sanitize_path(temp_dir) + " -maxdepth 1 -type d | tail -1"));
-        if (!found_dir.empty() && found_dir != temp_dir) {
-            source_dir = found_dir;
+        for (const auto& entry : fs::directory_iterator(temp_dir, ec)) {
+            if (entry.is_directory(ec)) source_dir = entry.path().string();
         }
 
         std::cout << CYAN << "Building from source..." << RESET << std::endl;
         std::cout << YELLOW << "Note: This may take a while. Use --full-log to see build output." << RESET << std::endl;
 
+        std::string jobs = "-j" + std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+        auto build_step = [](const std::string& dir, const std::vector<std::string>& cmd) {
+            ExecOptions opts;
+            opts.cwd = dir;
+            opts.show_output = g_full_log;
+            return exec_status(cmd, opts) == 0;
+        };
+        auto install_step = [](const std::string& dir) {
+            ExecOptions opts;
+            opts.cwd = dir;
+            opts.show_output = true;
+            return exec_status({"sudo", "make", "install"}, opts) == 0;
+        };
+
         bool built = false;
 
         if (fs::exists(source_dir + "/CMakeLists.txt")) {
             std::cout << CYAN << "Detected CMake project" << RESET << std::endl;
-            std::string cmake_cmd = "cd " + sanitize_path(source_dir) + " && mkdir -p build && cd build && cmake .. && make -j$(nproc)";
-            built = (exec_status((g_full_log ? cmake_cmd : cmake_cmd + " > /dev/null 2>&1").c_str()) == 0);
+            std::string build_dir = source_dir + "/build";
+            fs::create_directories(build_dir, ec);
+            built = build_step(build_dir, {"cmake", ".."}) && build_step(build_dir, {"make", jobs});
 
             if (built) {
                 std::cout << CYAN << "Installing built files..." << RESET << std::endl;
-                if (exec_status(("cd " + sanitize_path(source_dir) + "/build && sudo make install").c_str()) == 0) {
+                if (install_step(build_dir)) {
                     std::cout << GREEN << "✓ Installation complete" << RESET << std::endl;
                 } else {
                     std::cout << YELLOW << "Build succeeded but install failed" << RESET << std::endl;
@@ -932,29 +5499,28 @@ void install_file(const std::string& filepath) {
             }
         } else if (fs::exists(source_dir + "/configure")) {
             std::cout << CYAN << "Detected autotools project" << RESET << std::endl;
-            std::string build_cmd = "cd " + sanitize_path(source_dir) + " && ./configure && make -j$(nproc)";
-            built = (exec_status((g_full_log ? build_cmd : build_cmd + " > /dev/null 2>&1").c_str()) == 0);
+            built = build_step(source_dir, {"./configure"}) && build_step(source_dir, {"make", jobs});
 
             if (built) {
                 std::cout << CYAN << "Installing built files..." << RESET << std::endl;
-                if (exec_status(("cd " + sanitize_path(source_dir) + " && sudo make install").c_str()) == 0) {
+                if (install_step(source_dir)) {
                     std::cout << GREEN << "✓ Installation complete" << RESET << std::endl;
                 }
             }
         } else if (fs::exists(source_dir + "/Makefile") || fs::exists(source_dir + "/makefile")) {
             std::cout << CYAN << "Detected Makefile project" << RESET << std::endl;
-            std::string build_cmd = "cd " + sanitize_path(source_dir) + " && make -j$(nproc)";
-            built = (exec_status((g_full_log ? build_cmd : build_cmd + " > /dev/null 2>&1").c_str()) == 0);
+            built = build_step(source_dir, {"make", jobs});
 
             if (built) {
                 std::cout << CYAN << "Installing built files..." << RESET << std::endl;
-                exec_status(("cd " + sanitize_path(source_dir) + " && sudo make install").c_str());
+                install_step(source_dir);
                 std::cout << GREEN << "✓ Installation complete" << RESET << std::endl;
             }
         } else {
             std::string dest = "/opt/" + name;
             std::cout << YELLOW << "No build system detected. Extracting to " << dest << RESET << std::endl;
-            if (exec_status(("sudo mkdir -p " + sanitize_path(dest) + " && sudo cp -r " + sanitize_path(source_dir) + "/* " + sanitize_path(dest)).c_str()) == 0) {
+            if (exec_status({"sudo", "mkdir", "-p", dest}) == 0 &&
+                exec_status({"sudo", "cp", "-r", source_dir + "/.", dest}) == 0) {
                 std::cout << GREEN << "✓ Extracted to " << dest << RESET << std::endl;
             }
         }
@@ -966,7 +5532,7 @@ void install_file(const std::string& filepath) {
         }
 
         if (!g_keep && !g_config.keep_build) {
-            exec_status(("rm -rf " + sanitize_path(temp_dir)).c_str());
+            fs::remove_all(temp_dir, ec);
         } else {
             std::cout << CYAN << "Build files kept in: " << temp_dir << RESET << std::endl;
         }
@@ -975,44 +5541,599 @@ void install_file(const std::string& filepath) {
     }
 }
 
-void show_outdated(const std::string& time_val) {
+void show_outdated(const std::string& time_val, const std::string& sort_by = "name", size_t limit = 0) {
     int days = parse_time_value(time_val);
     std::cout << CYAN << "Finding packages not updated in " << days << " days..." << RESET << std::endl;
 
-    std::string installed = exec("pacman -Q");
-    std::istringstream iss(installed);
-    std::string line;
-
     time_t now = time(nullptr);
     time_t threshold = now - (days * 86400);
 
-    std::vector<std::string> outdated_pkgs;
-
-    while (std::getline(iss, line)) {
-        std::string pkg = line.substr(0, line.find(' '));
-        std::string date = get_package_date_pacman(pkg);
+    // One pass over the local table; the sync index supplies the repo build date,
+    // foreign (AUR/local) packages fall back to their own BUILDDATE.
+    std::vector<std::pair<std::string, time_t>> outdated_pkgs;
+    const SyncIndex& sync = sync_index();
+    SyncPackage info;
 
-        if (!date.empty()) {
-            struct tm tm_date = {};
-            if (strptime(date.c_str(), "%d %B %Y", &tm_date) || strptime(date.c_str(), "%Y-%m-%d", &tm_date)) {
-                time_t pkg_time = mktime(&tm_date);
-                if (pkg_time < threshold) {
-                    outdated_pkgs.push_back(pkg + " (last updated: " + date + ")");
-                }
-            }
+    for (const auto& installed : local_db().packages()) {
+        time_t built = installed.build_date;
+        if (sync.find(installed.name, &info) && info.build_date != 0) {
+            built = info.build_date;
         }
+        if (built != 0 && built < threshold) {
+            outdated_pkgs.push_back({installed.name, built});
+        }
+    }
+
+    if (sort_by == "date") {
+        std::stable_sort(outdated_pkgs.begin(), outdated_pkgs.end(),
+                         [](const auto& a, const auto& b) { return a.second < b.second; });
     }
 
     if (outdated_pkgs.empty()) {
         std::cout << GREEN << "No packages found" << RESET << std::endl;
     } else {
-        std::cout << YELLOW << "Found " << outdated_pkgs.size() << " outdated packages:" << RESET << std::endl;
+        std::cout << YELLOW << "Found " << outdated_pkgs.size() << " outdated packages";
+        if (limit > 0 && limit < outdated_pkgs.size()) std::cout << " (showing " << limit << ")";
+        std::cout << ":" << RESET << std::endl;
+
+        size_t shown = 0;
         for (const auto& pkg : outdated_pkgs) {
-            std::cout << "  " << pkg << std::endl;
+            if (limit > 0 && shown++ >= limit) break;
+            std::cout << "  " << pkg.first << " (last updated: " << format_date(pkg.second) << ")\n";
+        }
+        std::cout << std::flush;
+    }
+}
+
+// Script-friendly presence checks: one "name version" line per hit, a
+// message on stderr per miss, and a non-zero status if anything was missing.
+int check_installed(const std::vector<std::string>& pkgs) {
+    int status = 0;
+    for (const auto& pkg : pkgs) {
+        std::string name = sanitize_package(pkg);
+        if (const LocalPackage* local = local_db().find(name)) {
+            std::cout << local->name << " " << local->version << "\n";
+        } else if (const FlatpakApp* app = flatpak_index().find(name)) {
+            std::cout << app->id << " " << app->branch << " (flatpak)\n";
+        } else {
+            std::cerr << RED << "Package \"" << pkg << "\" is not installed" << RESET << std::endl;
+            status = 1;
+        }
+    }
+    std::cout << std::flush;
+    return status;
+}
+
+int check_available(const std::vector<std::string>& pkgs) {
+    std::vector<std::string> aur_candidates;
+    for (const auto& pkg : pkgs) {
+        if (!package_in_pacman(pkg)) aur_candidates.push_back(pkg);
+    }
+    aur_prefetch(aur_candidates);
+
+    int status = 0;
+    for (const auto& pkg : pkgs) {
+        SyncPackage info;
+        if (sync_index().find(sanitize_package(pkg), &info)) {
+            std::cout << info.repo << "/" << info.name << " " << info.version << "\n";
+        } else if (const AurPackage* aur_pkg = aur_lookup(pkg)) {
+            std::cout << "aur/" << aur_pkg->name << " " << aur_pkg->version << "\n";
+        } else {
+            std::cerr << RED << "Package \"" << pkg << "\" was not found on pacman or the AUR" << RESET << std::endl;
+            status = 1;
+        }
+    }
+    std::cout << std::flush;
+    return status;
+}
+
+// Path as the file lists have it: relative to the root, no leading '/'.
+std::string file_index_key(const std::string& path) {
+    std::string key = fs::path(path).lexically_normal().string();
+    return key.substr(std::min(key.size(), key.find_first_not_of('/')));
+}
+
+// An exact `rinse owns` argument as an absolute path: a bare name through
+// $PATH, a relative path from the current directory. Clients resolve these
+// before asking the daemon, whose PATH and working directory aren't theirs.
+std::string owns_path(const std::string& arg) {
+    std::string path = arg;
+    if (path.find('/') == std::string::npos) {
+        const char* env = getenv("PATH");
+        std::istringstream dirs(env ? env : "");
+        for (std::string dir; std::getline(dirs, dir, ':');) {
+            std::error_code ec;
+            if (!dir.empty() && fs::exists(dir + "/" + arg, ec)) {
+                path = dir + "/" + arg;
+                break;
+            }
+        }
+    }
+    std::error_code ec;
+    if (path[0] != '/') path = fs::absolute(path, ec).lexically_normal().string();
+    return path;
+}
+
+// `rinse owns`: the packages owning a path, like pacman -Qo, from the file
+// index. A bare name is looked up in $PATH and a relative path taken from
+// the current directory. With --prefix, everything under each path is
+// listed, and a path with *, ? or [ in it is a glob, where * matches '/'
+// too; both are taken from the root and print "package /path" lines, as
+// pacman -Ql does.
+int find_owners(const std::vector<std::string>& args) {
+    const FileIndex& index = file_index();
+    bool prefix = false;
+    int status = 0;
+    for (const auto& arg : args) {
+        if (arg == "--prefix") {
+            prefix = true;
+            continue;
+        }
+        if (arg.empty()) continue;
+
+        bool glob = arg.find_first_of("*?[") != std::string::npos;
+        if (prefix || glob) {
+            std::string pattern = "/" + file_index_key(arg);
+            std::string literal = pattern.substr(1, glob ? pattern.find_first_of("*?[") - 1 : std::string::npos);
+            size_t matches = 0;
+            auto print = [&](std::string_view path, uint32_t pkg) {
+                std::cout << index.package_name(pkg) << " /" << path << "\n";
+                matches++;
+                return true;
+            };
+            if (glob) {
+                for (const auto& [path, pkg] : index.glob(literal, pattern)) print(path, pkg);
+            } else {
+                index.scan(literal, print);
+            }
+            if (matches == 0) {
+                std::cerr << RED << "No package owns anything " << (glob ? "matching " : "under ") << arg << RESET << std::endl;
+                status = 1;
+            }
+            continue;
+        }
+
+        std::string path = owns_path(arg);
+        std::error_code ec;
+
+        std::vector<std::pair<std::string, uint32_t>> owners;
+        auto lookup = [&](const std::string& candidate) {
+            std::string key = file_index_key(candidate);
+            for (const std::string& exact : {key, key + "/"}) {
+                index.scan(exact, [&](std::string_view found, uint32_t pkg) {
+                    if (found != exact) return false;
+                    owners.emplace_back("/" + exact, pkg);
+                    return true;
+                });
+                if (!owners.empty() || key.empty() || key.back() == '/') break;
+            }
+        };
+        lookup(path);
+        // Through a symlinked directory (/bin -> usr/bin), as pacman resolves it.
+        if (owners.empty()) {
+            fs::path parent = fs::canonical(fs::path(path).parent_path(), ec);
+            if (!ec) lookup((parent / fs::path(path).filename()).string());
+        }
+
+        if (owners.empty()) {
+            std::cerr << RED << "No package owns " << path << RESET << std::endl;
+            status = 1;
+        }
+        for (const auto& [owned, pkg] : owners) {
+            std::cout << owned << " is owned by " << index.package_name(pkg) << " " << index.package_version(pkg) << "\n";
+        }
+    }
+    std::cout << std::flush;
+    return status;
+}
+
+// `rinse files`: the files a package installed, as pacman -Ql lists them.
+int list_package_files(const std::vector<std::string>& pkgs) {
+    const FileIndex& index = file_index();
+    int status = 0;
+    for (const auto& pkg : pkgs) {
+        long id = index.find_package(sanitize_package(pkg));
+        if (id < 0) {
+            std::cerr << RED << "Package \"" << pkg << "\" is not installed" << RESET << std::endl;
+            status = 1;
+            continue;
+        }
+        for (const auto& path : index.package_files(id)) std::cout << index.package_name(id) << " /" << path << "\n";
+    }
+    std::cout << std::flush;
+    return status;
+}
+
+struct QueryOptions {
+    std::string time_val;
+    std::string sort_by = "name";
+    size_t limit = 0;
+};
+
+// Commands that only read package state, so the daemon can answer them.
+bool is_query_command(const std::string& cmd) {
+    static const std::set<std::string> commands = {"-Q", "-Qs", "lookup", "check", "list", "search",
+                                                   "outdated", "installed", "available", "owns", "files"};
+    return commands.count(cmd) > 0;
+}
+
+int run_query(const std::vector<std::string>& args, const QueryOptions& opts) {
+    const std::string& cmd = args[0];
+    std::vector<std::string> rest(args.begin() + 1, args.end());
+
+    if (cmd == "outdated") {
+        show_outdated(opts.time_val, opts.sort_by, opts.limit);
+        return 0;
+    }
+    if (cmd == "installed" || cmd == "available") {
+        if (rest.empty()) {
+            std::cerr << RED << "Error: No package specified\n" << RESET;
+            return 1;
+        }
+        return cmd == "installed" ? check_installed(rest) : check_available(rest);
+    }
+    if (cmd == "owns" || cmd == "files") {
+        if (rest.empty()) {
+            std::cerr << RED << "Error: No " << (cmd == "owns" ? "path" : "package") << " specified\n" << RESET;
+            return 1;
         }
+        return cmd == "owns" ? find_owners(rest) : list_package_files(rest);
+    }
+    lookup_packages(rest);
+    return 0;
+}
+
+// Per-user daemon (`rinse daemon`, or the binary invoked as `rinsed`) that
+// keeps the local, sync and flatpak indexes warm and answers query commands
+// over a Unix socket. inotify on the pacman db and flatpak dirs drops the
+// affected index, and it is rebuilt once the burst of events settles.
+//
+// Wire format: the client sends NUL-terminated "key=value" fields and shuts
+// down its write side; the daemon replies "<status> <stdout bytes>\n"
+// followed by stdout and then stderr, or "fallback\n" when the request
+// needs something it can't serve (e.g. a different --dbpath).
+std::string daemon_socket_path() {
+    const char* socket_env = getenv("RINSE_SOCKET");
+    if (socket_env && *socket_env) return socket_env;
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) return std::string(runtime) + "/rinse.sock";
+    return "/tmp/rinse-" + std::to_string(getuid()) + ".sock";
+}
+
+bool make_socket_address(const std::string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool recv_all(int fd, std::string& out) {
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) return true;
+        out.append(buffer, n);
+    }
+}
+
+void set_socket_timeout(int fd, int seconds) {
+    timeval tv = {seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int connect_daemon() {
+    sockaddr_un addr;
+    if (!make_socket_address(daemon_socket_path(), addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    // The /tmp fallback path can be bound by anyone, so the daemon has to
+    // prove it runs as us before its answers are trusted.
+    ucred cred = {};
+    socklen_t len = sizeof(cred);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != getuid()) {
+        close(fd);
+        return -1;
     }
+    return fd;
+}
+
+// Sends a query to the daemon and prints its answer. Returns false (and
+// prints nothing) when no daemon is running or it declined, so the caller
+// runs the query in-process instead.
+bool daemon_query(const std::vector<std::string>& args, const QueryOptions& opts, int& status) {
+    int fd = connect_daemon();
+    if (fd < 0) return false;
+    set_socket_timeout(fd, 30);
+
+    std::string request;
+    auto field = [&request](const std::string& key, const std::string& value) {
+        request += key + "=" + value;
+        request += '\0';
+    };
+    field("dbpath", g_dbpath);
+    field("offline", g_offline ? "1" : "0");
+    field("time", opts.time_val);
+    field("sort", opts.sort_by);
+    field("limit", std::to_string(opts.limit));
+    for (const auto& arg : args) field("arg", arg);
+
+    std::string response;
+    bool ok = send_all(fd, request) && shutdown(fd, SHUT_WR) == 0 && recv_all(fd, response);
+    close(fd);
+
+    size_t newline = response.find('\n');
+    if (!ok || newline == std::string::npos || response.compare(0, newline, "fallback") == 0) return false;
+
+    std::istringstream header(response.substr(0, newline));
+    size_t out_size = 0;
+    if (!(header >> status >> out_size) || newline + 1 + out_size > response.size()) return false;
+
+    std::cout << response.substr(newline + 1, out_size) << std::flush;
+    std::cerr << response.substr(newline + 1 + out_size) << std::flush;
+    return true;
+}
+
+volatile sig_atomic_t g_daemon_stop = 0;
+
+void handle_daemon_signal(int) {
+    g_daemon_stop = 1;
 }
 
+class Daemon {
+public:
+    int run() {
+        path_ = daemon_socket_path();
+        sockaddr_un addr;
+        if (!make_socket_address(path_, addr)) {
+            std::cerr << RED << "Socket path is too long: " << path_ << RESET << std::endl;
+            return 1;
+        }
+
+        int existing = connect_daemon();
+        if (existing >= 0) {
+            close(existing);
+            std::cerr << YELLOW << "rinse daemon is already running on " << path_ << RESET << std::endl;
+            return 1;
+        }
+        unlink(path_.c_str());
+
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        mode_t old_mask = umask(0077);
+        bool bound = listen_fd_ >= 0 && bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) == 0;
+        umask(old_mask);
+        if (!bound || listen(listen_fd_, 16) != 0) {
+            std::cerr << RED << "Could not listen on " << path_ << ": " << strerror(errno) << RESET << std::endl;
+            return 1;
+        }
+
+        struct sigaction sa = {};
+        sa.sa_handler = handle_daemon_signal;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+        // Only delivered while ppoll waits, so client threads never take them
+        // and the loop always wakes up to stop.
+        sigset_t stop_signals, wait_mask;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+
+        watch_fd_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        const char* system_dir = getenv("FLATPAK_SYSTEM_DIR");
+        const char* user_dir = getenv("FLATPAK_USER_DIR");
+        add_watch(g_dbpath, LOCAL | SYNC);
+        add_watch(g_dbpath + "/local", LOCAL);
+        add_watch(g_dbpath + "/sync", SYNC);
+        add_watch(std::string(system_dir && *system_dir ? system_dir : "/var/lib/flatpak") + "/app", FLATPAK);
+        add_watch((user_dir && *user_dir ? std::string(user_dir) : get_home() + "/.local/share/flatpak") + "/app", FLATPAK);
+
+        refresh(LOCAL | SYNC | FLATPAK);
+        std::cout << GREEN << "rinse daemon listening on " << path_ << RESET << std::endl;
+
+        while (!g_daemon_stop) {
+            struct pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {watch_fd_, POLLIN, 0}};
+            timespec settle = {0, SETTLE_MS * 1000000L};
+            bool dirty;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                dirty = dirty_ != 0;
+            }
+            int ready = ppoll(fds, watch_fd_ >= 0 ? 2 : 1, dirty ? &settle : nullptr, &wait_mask);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (ready == 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                refresh(dirty_);
+                continue;
+            }
+            if (watch_fd_ >= 0 && (fds[1].revents & POLLIN)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                read_events();
+            }
+            if (fds[0].revents & POLLIN) {
+                int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client >= 0) {
+                    // Each client gets its own thread, so one that is slow to
+                    // send its request only holds up itself.
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    clients_.insert(client);
+                    std::thread([this, client]() {
+                        serve(client);
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        close(client);
+                        clients_.erase(client);
+                        if (clients_.empty()) idle_.notify_all();
+                    }).detach();
+                }
+            }
+        }
+
+        // Clients still sending or reading are cut off rather than waited out.
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (int client : clients_) shutdown(client, SHUT_RDWR);
+            idle_.wait(lock, [this]() { return clients_.empty(); });
+        }
+        close(listen_fd_);
+        if (watch_fd_ >= 0) close(watch_fd_);
+        unlink(path_.c_str());
+        return 0;
+    }
+
+private:
+    enum : int { LOCAL = 1, SYNC = 2, FLATPAK = 4 };
+    static constexpr int SETTLE_MS = 500;
+
+    std::string path_;
+    int listen_fd_ = -1;
+    int watch_fd_ = -1;
+    int dirty_ = 0;
+    std::map<int, int> watches_;
+    std::mutex mutex_;                  // dirty_, the indexes and everything run_query touches
+    std::condition_variable idle_;
+    std::set<int> clients_;             // connections being served
+
+    void add_watch(const std::string& dir, int what) {
+        if (watch_fd_ < 0) return;
+        int wd = inotify_add_watch(watch_fd_, dir.c_str(),
+                                   IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR);
+        if (wd >= 0) watches_[wd] |= what;
+    }
+
+    void read_events() {
+        alignas(inotify_event) char buffer[16 * 1024];
+        ssize_t n;
+        while ((n = read(watch_fd_, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + n;) {
+                auto* ev = reinterpret_cast<inotify_event*>(p);
+                auto it = watches_.find(ev->wd);
+                if (it != watches_.end()) {
+                    // In the db root only the transaction lock matters: its
+                    // removal means pacman has finished writing.
+                    bool root = it->second == (LOCAL | SYNC);
+                    if (!root || (ev->len && strcmp(ev->name, "db.lck") == 0 && (ev->mask & IN_DELETE))) {
+                        dirty_ |= it->second;
+                    }
+                }
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+    }
+
+    void refresh(int what) {
+        if (what & (LOCAL | SYNC)) {
+            g_name_index.reset();
+            g_upgradable.reset();
+        }
+        if (what & LOCAL) {
+            g_local_db.reset();
+            g_dep_graph.reset();
+            local_db();
+            // Only kept warm once something has asked for it.
+            if (g_file_index) {
+                g_file_index.reset();
+                file_index();
+            }
+        }
+        if (what & SYNC) {
+            g_sync_index.reset();
+            sync_index();
+        }
+        if (what & FLATPAK) {
+            g_flatpak_index.reset();
+            flatpak_index();
+        }
+        dirty_ &= ~what;
+    }
+
+    void serve(int fd) {
+        set_socket_timeout(fd, 5);
+
+        ucred cred = {};
+        socklen_t len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != getuid()) return;
+
+        std::string request;
+        if (!recv_all(fd, request)) return;
+
+        std::vector<std::string> args;
+        QueryOptions opts;
+        std::string dbpath;
+        bool offline = false;
+        size_t start = 0;
+        while (start < request.size()) {
+            size_t end = request.find('\0', start);
+            if (end == std::string::npos) end = request.size();
+            std::string item = request.substr(start, end - start);
+            start = end + 1;
+
+            size_t eq = item.find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = item.substr(0, eq);
+            std::string value = item.substr(eq + 1);
+            if (key == "dbpath") dbpath = value;
+            else if (key == "offline") offline = value == "1";
+            else if (key == "time") opts.time_val = value;
+            else if (key == "sort") opts.sort_by = value;
+            else if (key == "limit") opts.limit = std::strtoul(value.c_str(), nullptr, 10);
+            else if (key == "arg") args.push_back(value);
+        }
+
+        if (args.empty() || !is_query_command(args[0]) || dbpath != g_dbpath) {
+            send_all(fd, "fallback\n");
+            return;
+        }
+
+        // Queries run one at a time: they share the indexes, g_offline and
+        // std::cout. The reply is sent after letting go, so a client that
+        // reads slowly doesn't hold up the next one.
+        std::ostringstream out, err;
+        int status;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Pending changes are applied before answering, never after.
+            if (watch_fd_ >= 0) read_events();
+            if (dirty_) refresh(dirty_);
+
+            // Per-run AUR state is dropped so the disk cache TTL still applies.
+            {
+                std::lock_guard<std::recursive_mutex> aur_lock(g_aur_mutex);
+                g_aur_info.clear();
+                g_aur_queried.clear();
+            }
+            g_offline = offline;
+
+            std::streambuf* old_out = std::cout.rdbuf(out.rdbuf());
+            std::streambuf* old_err = std::cerr.rdbuf(err.rdbuf());
+            status = run_query(args, opts);
+            std::cout.rdbuf(old_out);
+            std::cerr.rdbuf(old_err);
+        }
+
+        std::string body = out.str();
+        send_all(fd, std::to_string(status) + " " + std::to_string(body.size()) + "\n" + body + err.str());
+    }
+};
+
 void print_help() {
     std::cout << BOLD << "rinse" << RESET << " - Fast CLI frontend for pacman and AUR\n";
     std::cout << CYAN << "Version 0.3.1" << RESET << "\n\n";
@@ -1028,6 +6149,9 @@ void print_help() {
 
     std::cout << BOLD << "PACKAGE MANAGEMENT:\n" << RESET;
     std::cout << "  rinse update                 Update all packages (pacman + AUR)\n";
+    std::cout << "  rinse update --check         List available updates without installing (no root)\n";
+    std::cout << "  rinse checkupdates           Same, against freshly downloaded sync databases\n";
+    std::cout << "  rinse mirrors [file]         Rank the mirrorlist by speed and freshness\n";
     std::cout << "  rinse upgrade                Alias for update\n";
     std::cout << "  rinse new                    Alias for update\n";
     std::cout << "  rinse -Syu                   pacman-style update\n";
@@ -1049,15 +6173,32 @@ void print_help() {
     std::cout << "  rinse list [term]...         Alias for lookup\n";
     std::cout << "  rinse search [term]...       Alias for lookup\n";
     std::cout << "  rinse -Q [term]...           pacman-style query\n";
-    std::cout << "  rinse -Qs <term>...          pacman-style search installed\n\n";
+    std::cout << "  rinse -Qs <term>...          pacman-style search installed\n";
+    std::cout << "  rinse installed <pkg>...     Print versions; exit 1 if any isn't installed\n";
+    std::cout << "  rinse available <pkg>...     Print repo/AUR versions; exit 1 if any isn't found\n";
+    std::cout << "  rinse owns <path>...         Which packages own a file (--prefix, or a glob)\n";
+    std::cout << "  rinse files <pkg>...         List the files a package installed\n";
+    std::cout << "  rinse vercmp <a> <b>         Compare two versions like pacman's vercmp\n\n";
+
+    std::cout << BOLD << "DAEMON:\n" << RESET;
+    std::cout << "  rinse daemon                 Keep package indexes warm and answer queries\n";
+    std::cout << "                               over $XDG_RUNTIME_DIR/rinse.sock (also: rinsed)\n\n";
 
     std::cout << BOLD << "FLAGS:\n" << RESET;
     std::cout << "  --dry-run, -n, dry           Show what would be done without doing it\n";
     std::cout << "  -y, --yes                    Auto-confirm all prompts (skip confirmations)\n";
-    std::cout << "  -k, --keep                   Keep build files after AUR installation\n";
+    std::cout << "  -k, --keep                   Keep makepkg's src/ and pkg/ dirs after AUR builds\n";
     std::cout << "  --time <value>               Set time threshold for outdated command\n";
     std::cout << "                               Examples: 5d (days), 3m (months), 2y (years)\n";
+    std::cout << "  --sort <name|date>           Sort outdated packages by name or age (oldest first)\n";
+    std::cout << "  --limit <n>                  Show at most n outdated packages\n";
     std::cout << "  --full-log                   Show complete installation output\n";
+    std::cout << "  --offline                    Answer AUR lookups from the local cache only\n";
+    std::cout << "  -b, --dbpath <path>          Read the pacman database from <path>\n";
+    std::cout << "                               (default: /var/lib/pacman)\n";
+    std::cout << "  --no-daemon                  Answer queries in-process even if rinsed is running\n";
+    std::cout << "  --trace=<file>               Write a Chrome trace of every command and phase\n";
+    std::cout << "                               to <file> (also: RINSE_TRACE=<file>)\n";
     std::cout << "  -h, --help, -help, --h       Show this help message\n\n";
 
     std::cout << BOLD << "EXAMPLES:\n" << RESET;
@@ -1067,6 +6208,7 @@ void print_help() {
     std::cout << "  rinse -Syu                   Update entire system\n";
     std::cout << "  rinse check fire             Search for 'fire' in installed packages\n";
     std::cout << "  rinse outdated --time 1y     Show packages not updated in 1 year\n";
+    std::cout << "  rinse outdated --sort date --limit 10   Show the 10 stalest packages\n";
     std::cout << "  rinse -n firefox             Dry run installation\n";
     std::cout << "  rinse ./package.pkg.tar.zst  Install from local file\n";
     std::cout << "  rinse clean -y               Clean cache (auto-confirm)\n\n";
@@ -1075,23 +6217,33 @@ void print_help() {
     std::cout << "  • Type 'yes' during prompts to auto-confirm remaining operations\n";
     std::cout << "  • Use -y flag to skip all confirmations: rinse -y update\n";
     std::cout << "  • Fuzzy search suggests similar packages when not found\n";
-    std::cout << "  • Progress bars show red 'FAILED' text when operations fail\n";
+    std::cout << "  • Progress bars follow the real pacman/yay/flatpak output (steps, throughput, ETA)\n";
+    std::cout << "  • Failed operations show their output; the last one is kept in ~/.cache/rinse/last-failure.log\n";
     std::cout << "  • Config file: ~/.config/rinse/rinse.conf\n\n";
 
     std::cout << BOLD << "CONFIGURATION:\n" << RESET;
     std::cout << "  Config file: " << CYAN << "~/.config/rinse/rinse.conf" << RESET << "\n";
     std::cout << "  Options:\n";
     std::cout << "    keep_build = true|false           Keep AUR build files (default: false)\n";
+    std::cout << "    keep_versions = 3                 Package versions 'rinse clean' keeps\n";
     std::cout << "    notify = true|false               Send desktop notifications (default: true)\n";
     std::cout << "    auto_update = true|false          Auto-check for rinse updates (default: true)\n";
     std::cout << "    update_branch = main|experimental Update branch (default: main)\n";
-    std::cout << "    outdated_time = 6m                Default threshold for outdated command\n\n";
+    std::cout << "    outdated_time = 6m                Default threshold for outdated command\n";
+    std::cout << "    aur_url = https://aur.archlinux.org  AUR server for package lookups\n";
+    std::cout << "    aur_cache_ttl = 60                Minutes to trust cached AUR lookups (0 = off)\n";
+    std::cout << "    aur_clone_url = https://aur.archlinux.org  Where AUR build files are cloned from\n";
+    std::cout << "    build_jobs = 2                    AUR packages built at the same time\n";
+    std::cout << "    build_cache_dir = <path>          Built AUR packages kept for reuse (can be shared)\n";
+    std::cout << "    pacman_conf = /etc/pacman.conf    Where repos and mirrors are read from\n";
+    std::cout << "    download_mirrors = 3              Mirrors per repo downloaded from at once (0: pacman)\n\n";
 
     std::cout << BOLD << "BEHAVIOR:\n" << RESET;
-    std::cout << "  • Packages are checked in pacman first, then AUR\n";
+    std::cout << "  • Packages are checked in pacman first, then AUR, then Flatpak\n";
+    std::cout << "  • All arguments are looked up concurrently, then one plan is confirmed\n";
     std::cout << "  • Official packages are installed before AUR packages\n";
     std::cout << "  • All pacman operations use a single call (no parallel runs)\n";
-    std::cout << "  • yay is auto-installed if needed for AUR packages\n";
+    std::cout << "  • AUR packages and their AUR dependencies are built with makepkg, in parallel where possible\n";
     std::cout << "  • Desktop notifications sent when notify=true in config\n";
     std::cout << "  • Sudo password requested once, then cached for operations\n\n";
 
@@ -1100,21 +6252,55 @@ void print_help() {
 }
 
 int main(int argc, char* argv[]) {
+    // Same output as pacman's vercmp: -1, 0 or 1. Checked before the root
+    // warning so scripts (bench/vercmp-vectors.sh) can read it as is.
+    if (argc == 4 && strcmp(argv[1], "vercmp") == 0) {
+        int r = vercmp(argv[2], argv[3]);
+        std::cout << (r < 0 ? -1 : r > 0 ? 1 : 0) << "\n";
+        return 0;
+    }
+
     // Check if running as root
     if (geteuid() == 0) {
         std::cout << YELLOW << "Warning: rinse isn't meant to be run as sudo!" << RESET << std::endl;
         std::cout << "Continuing anyway...\n" << std::endl;
     }
 
-    if (argc < 2) {
+    bool run_as_daemon = fs::path(argv[0]).filename() == "rinsed";
+
+    if (argc < 2 && !run_as_daemon) {
         print_help();
         return 0;
     }
 
-    load_config();
+    // The background AUR cache refresh started by aur_refresh_in_background.
+    // Handled before tracing, so it can't overwrite its parent's trace file.
+    if (argc > 2 && strcmp(argv[1], "--refresh-aur") == 0) {
+        load_config();
+        aur_fetch_and_cache(std::vector<std::string>(argv + 2, argv + argc));
+        return 0;
+    }
+
+    // Tracing starts before anything else so config loading is covered too.
+    const char* trace_env = getenv("RINSE_TRACE");
+    if (trace_env && *trace_env) g_tracer.start(trace_env);
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--trace=", 0) == 0) g_tracer.start(arg.substr(8));
+        else if (arg == "--trace" && i + 1 < argc) g_tracer.start(argv[i + 1]);
+    }
+
+    {
+        TracePhase phase("config");
+        load_config();
+    }
 
     std::vector<std::string> args;
     std::string time_override = "";
+    std::string outdated_sort = "name";
+    size_t outdated_limit = 0;
+    bool use_daemon = true;
+    bool check_only = false;
 
             for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -1125,10 +6311,30 @@ int main(int argc, char* argv[]) {
             g_keep = true;
         } else if (arg == "--full-log") {
             g_full_log = true;
+        } else if (arg == "--offline") {
+            g_offline = true;
+        } else if (arg == "--no-daemon") {
+            use_daemon = false;
+        } else if (arg == "--check") {
+            check_only = true;
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            // Handled above.
+        } else if (arg == "--trace" && i + 1 < argc) {
+            i++;
         } else if (arg == "-y" || arg == "--yes") {
             g_auto_confirm = true;
         } else if (arg == "--time" && i + 1 < argc) {
             time_override = sanitize_config(argv[++i]);
+        } else if (arg == "--sort" && i + 1 < argc) {
+            outdated_sort = sanitize_config(argv[++i]);
+            if (outdated_sort != "name" && outdated_sort != "date") {
+                std::cerr << RED << "Error: --sort must be 'name' or 'date'\n" << RESET;
+                return 1;
+            }
+        } else if (arg == "--limit" && i + 1 < argc) {
+            outdated_limit = std::strtoul(argv[++i], nullptr, 10);
+        } else if ((arg == "--dbpath" || arg == "-b") && i + 1 < argc) {
+            g_dbpath = argv[++i];
         } else if (arg == "--help" || arg == "-h" || arg == "-help" || arg == "--h" || arg == "help") {
             print_help();
             return 0;
@@ -1137,6 +6343,10 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (run_as_daemon || (!args.empty() && args[0] == "daemon")) {
+        return Daemon().run();
+    }
+
     if (args.empty()) {
         print_help();
         return 0;
@@ -1144,6 +6354,24 @@ int main(int argc, char* argv[]) {
 
     std::string cmd = args[0];
 
+    if (is_query_command(cmd)) {
+        QueryOptions opts;
+        opts.time_val = time_override.empty() ? g_config.outdated_time : time_override;
+        opts.sort_by = outdated_sort;
+        opts.limit = outdated_limit;
+        int status = 0;
+        if (cmd == "owns") {
+            // Globs and --prefix paths are taken from the root already.
+            bool prefix = false;
+            for (size_t i = 1; i < args.size(); i++) {
+                prefix |= args[i] == "--prefix";
+                if (!prefix && !args[i].empty() && args[i].find_first_of("*?[") == std::string::npos) args[i] = owns_path(args[i]);
+            }
+        }
+        if (use_daemon && daemon_query(args, opts, status)) return status;
+        return run_query(args, opts);
+    }
+
     if (cmd == "install" || cmd == "-S") {
         if (args.size() > 1) {
             install_packages(std::vector<std::string>(args.begin() + 1, args.end()));
@@ -1155,15 +6383,15 @@ int main(int argc, char* argv[]) {
         }
         remove_package(std::vector<std::string>(args.begin() + 1, args.end()));
     } else if (cmd == "update" || cmd == "upgrade" || cmd == "new" || cmd == "-Syu" || cmd == "-Syyu") {
+        if (check_only) return check_updates();
         update_system();
         update_rinse();
-    } else if (cmd == "-Q" || cmd == "-Qs" || cmd == "lookup" || cmd == "check" || cmd == "list" || cmd == "search") {
-        std::vector<std::string> search_terms(args.begin() + 1, args.end());
-        lookup_packages(search_terms);
     } else if (cmd == "clean" || cmd == "-Sc") {
         clean_cache();
-    } else if (cmd == "outdated") {
-        show_outdated(time_override.empty() ? g_config.outdated_time : time_override);
+    } else if (cmd == "checkupdates") {
+        return checkupdates();
+    } else if (cmd == "mirrors") {
+        return rank_mirrors(args.size() > 1 ? sanitize_path(args[1]) : "");
     } else if (fs::exists(cmd)) {
         install_file(cmd);
     } else {